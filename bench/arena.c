@@ -0,0 +1,96 @@
+/* Loads a database's worth of package records with malloc or out of
+ * an arena, then frees them, and reports the time taken and peak RSS.
+ * Each mode runs in its own process so the RSS figures are separate.
+ *
+ * Run as: arena-bench malloc|arena [count] */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "arena.h"
+#include "package.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The desc fields load_database() copies for every package */
+static void fill_pkg(struct pkg *pkg, struct arena *arena, size_t i)
+{
+    char filename[64];
+    snprintf(filename, sizeof(filename), "python-setuptools-%zu-1-any.pkg.tar.zst", i);
+
+    const char *values[] = {
+        filename, "python-setuptools", "69.0.3-1",
+        "Easily download, build, install, upgrade, and uninstall Python packages",
+        "https://pypi.org/project/setuptools/",
+        "abc0123456789def0123456789abc0123456789def0123456789abc0123456789",
+        "python", "x86_64",
+    };
+    char **fields[] = {
+        &pkg->filename, &pkg->name, &pkg->version, &pkg->desc,
+        &pkg->url, &pkg->sha256sum, &pkg->base, &pkg->arch,
+    };
+
+    for (size_t k = 0; k < sizeof(fields) / sizeof(fields[0]); ++k)
+        *fields[k] = arena ? arena_strdup(arena, values[k]) : strdup(values[k]);
+}
+
+static void free_pkg(struct pkg *pkg)
+{
+    free(pkg->filename);
+    free(pkg->name);
+    free(pkg->version);
+    free(pkg->desc);
+    free(pkg->url);
+    free(pkg->sha256sum);
+    free(pkg->base);
+    free(pkg->arch);
+    free(pkg);
+}
+
+int main(int argc, char *argv[])
+{
+    bool use_arena = argc > 1 && strcmp(argv[1], "arena") == 0;
+    size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 200000;
+    if (argc < 2 || (!use_arena && strcmp(argv[1], "malloc") != 0) || count == 0) {
+        fprintf(stderr, "usage: arena-bench malloc|arena [count]\n");
+        return 1;
+    }
+
+    struct arena arena;
+    arena_init(&arena);
+    struct pkg **pkgs = malloc(count * sizeof(struct pkg *));
+
+    double start = now();
+    for (size_t i = 0; i < count; ++i) {
+        pkgs[i] = use_arena ? arena_alloc(&arena, sizeof(struct pkg))
+                            : malloc(sizeof(struct pkg));
+        *pkgs[i] = (struct pkg){ .arena = use_arena ? &arena : NULL };
+        fill_pkg(pkgs[i], use_arena ? &arena : NULL, i);
+    }
+    double load = now() - start;
+
+    start = now();
+    if (use_arena) {
+        arena_release(&arena);
+    } else {
+        for (size_t i = 0; i < count; ++i)
+            free_pkg(pkgs[i]);
+    }
+    double release = now() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-6s  %zu packages: load %.0f ms, free %.1f ms, peak RSS %.1f MB\n",
+           argv[1], count, load * 1e3, release * 1e3, usage.ru_maxrss / 1024.0);
+
+    free(pkgs);
+    return 0;
+}
@@ -0,0 +1,200 @@
+/* Runs the desc parser repose used to have, which copied every byte of
+ * a value into its store, desc_parser_feed(), which hands values out as
+ * spans of the input, and desc_parse(), which finds lines with the
+ * vectorized scanner, over the same decompressed desc entries. Unlike
+ * the -v trace in load_database(), which also counts decompression and
+ * the archive walk, this is only the parsing. With -f the entries are
+ * %FILES% listings instead, 150 paths each.
+ *
+ * Run as: desc-bench [-f] [count] */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <time.h>
+
+#include "arena.h"
+#include "buffer.h"
+#include "desc.h"
+#include "old_desc.h"
+#include "package.h"
+
+#define ROUNDS 5
+#define FILES_PER_ENTRY 150
+
+enum parser {
+    PARSER_OLD,
+    PARSER_FEED,
+    PARSER_SCAN,
+};
+
+struct entries {
+    struct buffer data;
+    size_t *ends;
+    size_t count;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Something shaped like a signature, so the longest value in a real
+ * desc entry is represented */
+static void put_signature(struct buffer *buf, size_t seed)
+{
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    for (size_t k = 0; k < 440; ++k) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        buffer_putc(buf, alphabet[(seed >> 33) % 64]);
+    }
+    buffer_append(buf, "=\n\n", 3);
+}
+
+static void put_desc(struct buffer *buf, size_t i)
+{
+    buffer_printf(buf,
+                  "%%FILENAME%%\npython-pkg%zu-1.0.%zu-1-x86_64.pkg.tar.zst\n\n"
+                  "%%NAME%%\npython-pkg%zu\n\n"
+                  "%%BASE%%\npython-pkg%zu\n\n"
+                  "%%VERSION%%\n1.0.%zu-1\n\n"
+                  "%%DESC%%\nA synthetic package for measuring how fast desc entries parse\n\n"
+                  "%%CSIZE%%\n%zu\n\n"
+                  "%%ISIZE%%\n%zu\n\n"
+                  "%%SHA256SUM%%\n%064zx\n\n",
+                  i, i, i, i, i, 100000 + i, 400000 + i, i);
+
+    buffer_printf(buf, "%%PGPSIG%%\n");
+    put_signature(buf, i);
+
+    buffer_printf(buf,
+                  "%%URL%%\nhttps://example.org/python-pkg%zu\n\n"
+                  "%%LICENSE%%\nMIT\n\n"
+                  "%%ARCH%%\nx86_64\n\n"
+                  "%%BUILDDATE%%\n%zu\n\n"
+                  "%%PACKAGER%%\nA Packager <packager@example.org>\n\n"
+                  "%%DEPENDS%%\nglibc\npython>=3.11\npython-setuptools\n\n"
+                  "%%MAKEDEPENDS%%\npython-build\npython-installer\npython-wheel\n\n",
+                  i, 1700000000 + i);
+}
+
+static void put_files(struct buffer *buf, size_t i)
+{
+    buffer_printf(buf, "%%FILES%%\nusr/\nusr/lib/\nusr/lib/python3.11/\n"
+                  "usr/lib/python3.11/site-packages/\n");
+
+    for (size_t k = 0; k < FILES_PER_ENTRY - 4; ++k) {
+        if (k % 10 == 0)
+            buffer_printf(buf, "usr/lib/python3.11/site-packages/pkg%zu/sub%zu/\n", i, k / 10);
+        else
+            buffer_printf(buf, "usr/lib/python3.11/site-packages/pkg%zu/sub%zu/module%zu.py\n",
+                          i, k / 10, k);
+    }
+    buffer_putc(buf, '\n');
+}
+
+static void build_entries(struct entries *entries, size_t count, bool files)
+{
+    *entries = (struct entries){ .count = count };
+    entries->ends = malloc(count * sizeof(size_t));
+    if (!entries->ends)
+        err(EXIT_FAILURE, "failed to allocate entries");
+
+    for (size_t i = 0; i < count; ++i) {
+        if (files)
+            put_files(&entries->data, i);
+        else
+            put_desc(&entries->data, i);
+        entries->ends[i] = entries->data.len;
+    }
+}
+
+static ssize_t parse_entry(enum parser which, struct pkg *pkg, char *data, size_t len)
+{
+    if (which == PARSER_OLD) {
+        struct old_desc_parser parser;
+        old_desc_parser_init(&parser);
+        return old_desc_parser_feed(&parser, pkg, data, len);
+    }
+
+    struct desc_parser parser;
+    desc_parser_init(&parser);
+    if (which == PARSER_SCAN)
+        return desc_parse(&parser, pkg, data, len);
+    return desc_parser_feed(&parser, pkg, data, len);
+}
+
+/* Parse every entry into arena-backed packages, the way load_database()
+ * does, and report the best of a few rounds in MB/s */
+static double time_parse(const struct entries *entries, enum parser which)
+{
+    double best = 0;
+
+    for (int round = 0; round < ROUNDS; ++round) {
+        struct arena arena;
+        arena_init(&arena);
+
+        double start = now();
+        for (size_t i = 0, offset = 0; i < entries->count; ++i) {
+            struct pkg *pkg = arena_alloc(&arena, sizeof(struct pkg));
+            *pkg = (struct pkg){ .arena = &arena };
+
+            size_t len = entries->ends[i] - offset;
+            if (parse_entry(which, pkg, entries->data.data + offset, len) < 0)
+                errx(EXIT_FAILURE, "failed to parse entry %zu", i);
+            offset = entries->ends[i];
+        }
+        double elapsed = now() - start;
+
+        arena_release(&arena);
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return entries->data.len / best / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    bool files = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f")) != -1) {
+        switch (opt) {
+        case 'f':
+            files = true;
+            break;
+        default:
+            fprintf(stderr, "usage: desc-bench [-f] [count]\n");
+            return 1;
+        }
+    }
+
+    size_t count = files ? 20000 : 100000;
+    if (optind < argc)
+        count = strtoul(argv[optind++], NULL, 10);
+    if (optind < argc || count == 0) {
+        fprintf(stderr, "usage: desc-bench [-f] [count]\n");
+        return 1;
+    }
+
+    struct entries entries;
+    build_entries(&entries, count, files);
+
+    double old_rate = time_parse(&entries, PARSER_OLD);
+    double feed_rate = time_parse(&entries, PARSER_FEED);
+    double scan_rate = time_parse(&entries, PARSER_SCAN);
+    printf("%-5s %zu entries, %.1f MB: old %7.1f MB/s  feed %7.1f MB/s  parse %7.1f MB/s\n",
+           files ? "files" : "desc", count, entries.data.len / 1e6,
+           old_rate, feed_rate, scan_rate);
+
+    buffer_release(&entries.data);
+    free(entries.ends);
+    return 0;
+}
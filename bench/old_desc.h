@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <limits.h>
+#include "package.h"
+
+struct old_desc_parser {
+    int cs;
+    enum pkg_entry entry;
+    uint64_t fields;
+    size_t pos;
+    char store[LINE_MAX];
+};
+
+void old_desc_parser_init(struct old_desc_parser *parser);
+ssize_t old_desc_parser_feed(struct old_desc_parser *parser, struct pkg *pkg,
+                             char *buf, size_t buf_len);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <alpm.h>
+#include <alpm_list.h>
+#include "package.h"
+
+struct old_pkgcache {
+    alpm_list_t **hash_table;
+    alpm_list_t *list;
+    size_t buckets;
+    size_t entries;
+    size_t limit;
+};
+
+hash_t sdbm(const char *str);
+
+struct old_pkgcache *old_pkgcache_create(size_t size);
+void old_pkgcache_free(struct old_pkgcache *cache);
+
+struct old_pkgcache *old_pkgcache_add(struct old_pkgcache *cache, struct pkg *pkg);
+struct old_pkgcache *old_pkgcache_add_sorted(struct old_pkgcache *cache, struct pkg *pkg);
+struct old_pkgcache *old_pkgcache_remove(struct old_pkgcache *cache, struct pkg *pkg,
+                                         struct pkg **data);
+
+struct pkg *old_pkgcache_find(struct old_pkgcache *cache, const char *name);
@@ -0,0 +1,129 @@
+/* Times reading .PKGINFO out of packages, the way the pool scan does,
+ * with the reader repose used to have against load_package(). The old
+ * reader fed libarchive through 8KiB read() calls and let every
+ * filter and format bid on the file; load_package() maps the package
+ * and only registers the filter its magic bytes call for.
+ *
+ * Run as: package-bench [-n iterations] package... */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "package.h"
+#include "pkginfo.h"
+#include "util.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct old_reader {
+    int fd;
+    char buf[8192];
+};
+
+static ssize_t old_read_cb(struct archive *archive, void *data, const void **buf)
+{
+    struct old_reader *reader = data;
+
+    ssize_t nbytes_r = read(reader->fd, reader->buf, sizeof(reader->buf));
+    if (nbytes_r < 0) {
+        archive_set_error(archive, errno, "failed to read package");
+        return -1;
+    }
+
+    *buf = reader->buf;
+    return nbytes_r;
+}
+
+static int old_load_package(struct pkg *pkg, int fd)
+{
+    struct old_reader reader = { .fd = fd };
+    struct archive *archive = archive_read_new();
+    archive_read_support_filter_all(archive);
+    archive_read_support_format_all(archive);
+
+    if (archive_read_open(archive, &reader, NULL, old_read_cb, NULL) != ARCHIVE_OK) {
+        archive_read_free(archive);
+        return -1;
+    }
+
+    int ret = -1;
+    struct archive_entry *entry;
+    while (archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
+        if (streq(archive_entry_pathname(entry), ".PKGINFO")) {
+            ret = read_pkginfo(archive, pkg) < 0 ? -1 : 0;
+            break;
+        }
+    }
+
+    archive_read_close(archive);
+    archive_read_free(archive);
+    return ret;
+}
+
+static double time_loads(const char *filename, size_t iterations, bool old)
+{
+    double start = now();
+
+    for (size_t i = 0; i < iterations; ++i) {
+        _cleanup_close_ int fd = open(filename, O_RDONLY);
+        check_posix(fd, "failed to open %s", filename);
+
+        struct pkg *pkg = calloc(1, sizeof(struct pkg));
+        check_null(pkg, "failed to allocate package");
+        pkg->filename = strdup(filename);
+
+        int ret = old ? old_load_package(pkg, fd) : load_package(pkg, fd, 0);
+        if (ret < 0)
+            errx(EXIT_FAILURE, "failed to load %s", filename);
+        package_free(pkg);
+    }
+
+    return (now() - start) / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t iterations = 200;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            iterations = 0;
+            break;
+        }
+    }
+
+    if (optind == argc || iterations == 0) {
+        fprintf(stderr, "usage: package-bench [-n iterations] package...\n");
+        return 1;
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        /* Warm the page cache so both readers see the same conditions */
+        time_loads(argv[i], 1, false);
+
+        double old_time = time_loads(argv[i], iterations, true);
+        double new_time = time_loads(argv[i], iterations, false);
+        printf("%-40s  old %7.1f us  new %7.1f us\n", argv[i],
+               old_time * 1e6, new_time * 1e6);
+    }
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+/* Measures insert, lookup and remove on the pkgcache against the table
+ * it replaced, or with "load", how long it takes to fill the cache in
+ * name order the way the database loader does.
+ *
+ * Run as: pkgcache-bench [load] [count] */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "pkgcache.h"
+#include "old_pkgcache.h"
+
+struct sample {
+    struct pkg *pkgs;
+    char **missing;
+    size_t count;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Names shaped like a real repo: long shared prefixes, lots of near
+ * duplicates, visited in a scattered order */
+static void make_sample(struct sample *sample, size_t count, hash_t (*hash)(const char *))
+{
+    sample->pkgs = calloc(count, sizeof(struct pkg));
+    sample->missing = calloc(count, sizeof(char *));
+    sample->count = count;
+
+    for (size_t i = 0; i < count; ++i) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s-%zx-lib%zu", i & 1 ? "python" : "perl",
+                 i * 2654435761u % 1000003, i);
+        sample->pkgs[i].name = strdup(buf);
+        sample->pkgs[i].hash = hash(buf);
+
+        snprintf(buf, sizeof(buf), "missing-%zu", i);
+        sample->missing[i] = strdup(buf);
+    }
+}
+
+static void report(const char *table, const struct sample *sample, double insert,
+                   double find, double miss, double remove)
+{
+    const size_t n = sample->count;
+    printf("%-6s insert %6.1f ns  find %6.1f ns  miss %6.1f ns  remove %6.1f ns\n",
+           table, insert / n * 1e9, find / n * 1e9, miss / n * 1e9, remove / (n / 2) * 1e9);
+}
+
+static void bench_new(const struct sample *sample)
+{
+    const size_t n = sample->count;
+    size_t hits = 0;
+
+    double start = now();
+    struct pkgcache *cache = pkgcache_create(100);
+    for (size_t i = 0; i < n; ++i)
+        cache = pkgcache_add(cache, &sample->pkgs[i]);
+    double insert = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < n; ++i)
+        hits += pkgcache_find(cache, sample->pkgs[i * 7919 % n].name) != NULL;
+    double find = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < n; ++i)
+        hits += pkgcache_find(cache, sample->missing[i]) != NULL;
+    double miss = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < n; i += 2)
+        cache = pkgcache_remove(cache, &sample->pkgs[i], NULL);
+    double remove = now() - start;
+
+    if (hits != n)
+        fprintf(stderr, "new table found %zu of %zu packages\n", hits, n);
+    report("new", sample, insert, find, miss, remove);
+    pkgcache_free(cache);
+}
+
+static void bench_old(const struct sample *sample)
+{
+    const size_t n = sample->count;
+    size_t hits = 0;
+
+    double start = now();
+    struct old_pkgcache *cache = old_pkgcache_create(100);
+    for (size_t i = 0; i < n; ++i)
+        cache = old_pkgcache_add(cache, &sample->pkgs[i]);
+    double insert = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < n; ++i)
+        hits += old_pkgcache_find(cache, sample->pkgs[i * 7919 % n].name) != NULL;
+    double find = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < n; ++i)
+        hits += old_pkgcache_find(cache, sample->missing[i]) != NULL;
+    double miss = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < n; i += 2)
+        cache = old_pkgcache_remove(cache, &sample->pkgs[i], NULL);
+    double remove = now() - start;
+
+    if (hits != n)
+        fprintf(stderr, "old table found %zu of %zu packages\n", hits, n);
+    report("old", sample, insert, find, miss, remove);
+    old_pkgcache_free(cache);
+}
+
+static int name_cmp(const void *p1, const void *p2)
+{
+    const struct pkg *pkg1 = p1;
+    const struct pkg *pkg2 = p2;
+    return strcmp(pkg1->name, pkg2->name);
+}
+
+/* Databases are usually read back in the order they were written, so
+ * time both that and the worst case of a shuffled database */
+static void prepare_load(struct sample *sample, bool shuffle)
+{
+    qsort(sample->pkgs, sample->count, sizeof(struct pkg), name_cmp);
+    if (!shuffle)
+        return;
+
+    srand(1);
+    for (size_t i = sample->count - 1; i > 0; --i) {
+        size_t j = rand() % (i + 1);
+        struct pkg tmp = sample->pkgs[i];
+        sample->pkgs[i] = sample->pkgs[j];
+        sample->pkgs[j] = tmp;
+    }
+}
+
+static void bench_load(size_t count)
+{
+    static const char *orders[] = { "tar order", "shuffled" };
+
+    printf("loading %zu packages\n", count);
+    for (int shuffle = 0; shuffle < 2; ++shuffle) {
+        struct sample old_sample, new_sample;
+        make_sample(&old_sample, count, sdbm);
+        make_sample(&new_sample, count, strhash);
+        prepare_load(&old_sample, shuffle);
+        prepare_load(&new_sample, shuffle);
+
+        double start = now();
+        struct old_pkgcache *old = old_pkgcache_create(100);
+        for (size_t i = 0; i < count; ++i)
+            old = old_pkgcache_add_sorted(old, &old_sample.pkgs[i]);
+        double old_time = now() - start;
+
+        start = now();
+        struct pkgcache *cache = pkgcache_create(100);
+        for (size_t i = 0; i < count; ++i)
+            cache = pkgcache_add(cache, &new_sample.pkgs[i]);
+        pkgcache_sort(cache);
+        double new_time = now() - start;
+
+        printf("%-9s  sorted insert %.3fs  append + sort %.3fs\n",
+               orders[shuffle], old_time, new_time);
+        old_pkgcache_free(old);
+        pkgcache_free(cache);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool load = argc > 1 && strcmp(argv[1], "load") == 0;
+    if (load)
+        --argc, ++argv;
+
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 30000;
+    if (count < 2) {
+        fprintf(stderr, "usage: pkgcache-bench [load] [count]\n");
+        return 1;
+    }
+
+    if (load) {
+        bench_load(count);
+        return 0;
+    }
+
+    struct sample old_sample, new_sample;
+    make_sample(&old_sample, count, sdbm);
+    make_sample(&new_sample, count, strhash);
+
+    printf("%zu packages\n", count);
+    bench_old(&old_sample);
+    bench_new(&new_sample);
+    return 0;
+}
@@ -0,0 +1,93 @@
+/* Sorts a pool's worth of versions with alpm_pkg_vercmp() and with
+ * version keys. Run as: version-bench [count] */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <alpm.h>
+#include "version.h"
+
+static char **versions;
+static struct version_key **keys;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int alpm_cmp(const void *p1, const void *p2)
+{
+    return alpm_pkg_vercmp(versions[*(const size_t *)p1], versions[*(const size_t *)p2]);
+}
+
+static int key_cmp(const void *p1, const void *p2)
+{
+    return version_key_cmp(keys[*(const size_t *)p1], keys[*(const size_t *)p2]);
+}
+
+/* A mix of the shapes found in a real pool: plain releases, epochs,
+ * VCS snapshots and prereleases */
+static char *make_version(size_t i)
+{
+    char buf[64];
+
+    switch (i % 4) {
+    case 0:
+        snprintf(buf, sizeof(buf), "%d.%d.%d-%d", rand() % 5, rand() % 30,
+                 rand() % 200, rand() % 4 + 1);
+        break;
+    case 1:
+        snprintf(buf, sizeof(buf), "1:%d.%d-%d", rand() % 10, rand() % 100, rand() % 3 + 1);
+        break;
+    case 2:
+        snprintf(buf, sizeof(buf), "r%d.g%07x-1", rand() % 3000, rand());
+        break;
+    default:
+        snprintf(buf, sizeof(buf), "%d.%drc%d-%d", rand() % 3, rand() % 20,
+                 rand() % 5, rand() % 3 + 1);
+        break;
+    }
+
+    return strdup(buf);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    if (count == 0) {
+        fprintf(stderr, "usage: version-bench [count]\n");
+        return 1;
+    }
+
+    versions = malloc(count * sizeof(char *));
+    keys = malloc(count * sizeof(struct version_key *));
+    size_t *order = malloc(count * sizeof(size_t));
+
+    srand(1);
+    for (size_t i = 0; i < count; ++i)
+        versions[i] = make_version(i);
+
+    for (size_t i = 0; i < count; ++i)
+        order[i] = i;
+    double start = now();
+    qsort(order, count, sizeof(size_t), alpm_cmp);
+    double alpm_time = now() - start;
+
+    for (size_t i = 0; i < count; ++i)
+        order[i] = i;
+    start = now();
+    for (size_t i = 0; i < count; ++i)
+        keys[i] = version_key_new(versions[i]);
+    double build_time = now() - start;
+
+    start = now();
+    qsort(order, count, sizeof(size_t), key_cmp);
+    double key_time = now() - start;
+
+    printf("sorting %zu versions: alpm_pkg_vercmp %.0f ms, keys %.0f ms (+%.0f ms to build them)\n",
+           count, alpm_time * 1e3, key_time * 1e3, build_time * 1e3);
+    return 0;
+}
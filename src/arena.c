@@ -0,0 +1,115 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE 0x100000
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) char data[];
+};
+
+static inline size_t align_size(size_t size)
+{
+    const size_t align = alignof(max_align_t);
+    return (size + align - 1) & ~(align - 1);
+}
+
+void arena_init(struct arena *arena)
+{
+    *arena = (struct arena){0};
+    pthread_mutex_init(&arena->lock, NULL);
+}
+
+void arena_release(struct arena *arena)
+{
+    struct arena_chunk *chunk = arena->chunks;
+    while (chunk) {
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    pthread_mutex_destroy(&arena->lock);
+    *arena = (struct arena){0};
+}
+
+static struct arena_chunk *new_chunk(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk = malloc(sizeof(struct arena_chunk) + size);
+    if (!chunk)
+        return NULL;
+
+    *chunk = (struct arena_chunk){ .size = size };
+    arena->allocated += size;
+    return chunk;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    void *ptr = NULL;
+
+    if (size > SIZE_MAX - ARENA_CHUNK_SIZE)
+        return NULL;
+    size = align_size(size);
+
+    pthread_mutex_lock(&arena->lock);
+
+    struct arena_chunk *chunk = arena->chunks;
+    if (!chunk || chunk->size - chunk->used < size) {
+        /* Big allocations get a chunk of their own. Slot it in behind
+         * the current chunk so the space left there isn't lost. */
+        if (chunk && size > ARENA_CHUNK_SIZE / 4) {
+            struct arena_chunk *big = new_chunk(arena, size);
+            if (!big)
+                goto done;
+
+            big->used = size;
+            big->next = chunk->next;
+            chunk->next = big;
+            ptr = big->data;
+            goto done;
+        }
+
+        chunk = new_chunk(arena, size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE);
+        if (!chunk)
+            goto done;
+
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    ptr = chunk->data + chunk->used;
+    chunk->used += size;
+
+done:
+    if (ptr)
+        arena->used += size;
+    pthread_mutex_unlock(&arena->lock);
+    return ptr;
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t len)
+{
+    const char *end = memchr(str, 0, len);
+    if (end)
+        len = end - str;
+
+    char *copy = arena_alloc(arena, len + 1);
+    if (!copy)
+        return NULL;
+
+    memcpy(copy, str, len);
+    copy[len] = 0;
+    return copy;
+}
+
+char *arena_strdup(struct arena *arena, const char *str)
+{
+    return arena_strndup(arena, str, strlen(str));
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+#include <pthread.h>
+
+struct arena_chunk;
+
+/* A region allocator: allocations are bumped out of large chunks and
+ * only ever released all at once. Safe to share between threads. */
+struct arena {
+    struct arena_chunk *chunks;
+    size_t allocated;
+    size_t used;
+    pthread_mutex_t lock;
+};
+
+void arena_init(struct arena *arena);
+void arena_release(struct arena *arena);
+
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strndup(struct arena *arena, const char *str, size_t len);
+char *arena_strdup(struct arena *arena, const char *str);
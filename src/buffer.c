@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include <stdint.h>
 #include <errno.h>
 #include "util.h"
@@ -76,6 +77,17 @@ int buffer_putc(struct buffer *buf, const char c)
     return 0;
 }
 
+int buffer_append(struct buffer *buf, const char *data, size_t len)
+{
+    if (buffer_extendby(buf, len + 1) < 0)
+        return -errno;
+
+    memcpy(&buf->data[buf->len], data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
 ssize_t buffer_printf(struct buffer *buf, const char *fmt, ...)
 {
     size_t len = buf->buflen - buf->len;
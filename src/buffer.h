@@ -14,4 +14,5 @@ void buffer_release(struct buffer *buf);
 void buffer_clear(struct buffer *buf);
 
 int buffer_putc(struct buffer *buf, const char c);
+int buffer_append(struct buffer *buf, const char *data, size_t len);
 ssize_t buffer_printf(struct buffer *buf, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
@@ -0,0 +1,142 @@
+#include "checksum.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/xattr.h>
+#include <openssl/evp.h>
+
+#include "util.h"
+
+/* The digest is stored alongside the size and mtime of the file it was
+ * computed for:
+ *
+ *   <size> <mtime seconds>.<mtime nanoseconds> <sha256sum>
+ *
+ * If the file has since changed the xattr is simply ignored. */
+static const char checksum_xattr[] = "user.repose.sha256";
+
+/* Files which can't be mapped are read in large blocks instead */
+#define CHECKSUM_BLOCK_SIZE 0x100000
+
+static void sha256_update_fd(EVP_MD_CTX *ctx, int fd, size_t *hashed)
+{
+    struct stat st;
+    check_posix(fstat(fd, &st), "failed to stat file");
+
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            EVP_DigestUpdate(ctx, map, st.st_size);
+            munmap(map, st.st_size);
+            *hashed += st.st_size;
+            return;
+        }
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    _cleanup_free_ char *buf = malloc(CHECKSUM_BLOCK_SIZE);
+    check_null(buf, "failed to allocate read buffer");
+
+    for (;;) {
+        ssize_t nbytes_r = read(fd, buf, CHECKSUM_BLOCK_SIZE);
+        check_posix(nbytes_r, "failed to read file");
+        if (nbytes_r == 0)
+            break;
+        EVP_DigestUpdate(ctx, buf, nbytes_r);
+        *hashed += nbytes_r;
+    }
+}
+
+/* Goes through EVP rather than the low level SHA256 calls so OpenSSL
+ * picks the best implementation for the CPU, SHA extensions included */
+char *sha256_fd(int fd, size_t *hashed)
+{
+    unsigned char output[EVP_MAX_MD_SIZE];
+    unsigned int len;
+    size_t nbytes = 0;
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    check_null(ctx, "failed to allocate digest context");
+
+    EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+    sha256_update_fd(ctx, fd, &nbytes);
+    EVP_DigestFinal_ex(ctx, output, &len);
+    EVP_MD_CTX_free(ctx);
+
+    if (hashed)
+        *hashed += nbytes;
+    return hex_representation(output, len);
+}
+
+char *sha256_file(int dirfd, const char *filename, bool use_xattr, size_t *hashed)
+{
+    _cleanup_close_ int fd = openat(dirfd, filename, O_RDONLY);
+    check_posix(fd, "failed to open %s for sha256 checksum", filename);
+
+    if (use_xattr) {
+        char *sha256sum = checksum_xattr_get(fd);
+        if (sha256sum)
+            return sha256sum;
+    }
+
+    char *sha256sum = sha256_fd(fd, hashed);
+    if (use_xattr)
+        checksum_xattr_set(fd, sha256sum);
+    return sha256sum;
+}
+
+static int format_xattr(int fd, const char *sha256sum, char *buf, size_t len)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return -1;
+
+    return snprintf(buf, len, "%jd %jd.%09ld %s",
+                    (intmax_t)st.st_size, (intmax_t)st.st_mtim.tv_sec,
+                    st.st_mtim.tv_nsec, sha256sum);
+}
+
+char *checksum_xattr_get(int fd)
+{
+    char value[128];
+    ssize_t len = fgetxattr(fd, checksum_xattr, value, sizeof(value) - 1);
+    if (len < 0)
+        return NULL;
+    value[len] = 0;
+
+    char *sha256sum = strrchr(value, ' ');
+    if (!sha256sum || strlen(++sha256sum) != 64)
+        return NULL;
+
+    /* Render what the xattr should look like for the file as it is now
+     * and make sure it agrees with what was stored */
+    char expected[128];
+    if (format_xattr(fd, sha256sum, expected, sizeof(expected)) != len)
+        return NULL;
+    if (memcmp(expected, value, len) != 0)
+        return NULL;
+
+    return strdup(sha256sum);
+}
+
+/* Best effort: filesystems without user xattrs, read-only pools and
+ * packages we don't own just don't get their checksum remembered. */
+void checksum_xattr_set(int fd, const char *sha256sum)
+{
+    char value[128];
+    int len = format_xattr(fd, sha256sum, value, sizeof(value));
+    if (len < 0 || (size_t)len >= sizeof(value))
+        return;
+
+    fsetxattr(fd, checksum_xattr, value, len, 0);
+}
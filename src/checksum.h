@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+char *sha256_fd(int fd, size_t *hashed);
+char *sha256_file(int dirfd, const char *filename, bool use_xattr, size_t *hashed);
+
+char *checksum_xattr_get(int fd);
+void checksum_xattr_set(int fd, const char *sha256sum);
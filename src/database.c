@@ -13,7 +13,7 @@
 #include <err.h>
 #include <time.h>
 #include <sys/stat.h>
-#include <openssl/sha.h>
+#include <sys/resource.h>
 
 #include "repose.h"
 #include "package.h"
@@ -22,19 +22,51 @@
 #include "desc.h"
 #include "buffer.h"
 #include "signing.h"
+#include "checksum.h"
+#include "parallel.h"
+#include "pgzip.h"
+#include "intern.h"
 
 struct database_reader {
     struct archive *archive;
     struct pkg *likely_pkg;
     time_t mtime;
+    uint64_t fields;
+    size_t bytes;
+};
+
+/* Old databases kept dependencies in desc. They're always parsed so
+ * those entries can be found and split out; new ones don't have them so
+ * it costs nothing. */
+static const uint64_t depends_fields =
+    PKG_FIELD(PKG_DEPENDS) | PKG_FIELD(PKG_CONFLICTS) | PKG_FIELD(PKG_PROVIDES) |
+    PKG_FIELD(PKG_OPTDEPENDS) | PKG_FIELD(PKG_MAKEDEPENDS) | PKG_FIELD(PKG_CHECKDEPENDS);
+
+/* Everything a package contributes to the database, rendered ahead of
+ * being written out to the archive */
+/* The desc, depends and files entries are written straight out of
+ * the package's raw entries, only the deltas are rendered per slot */
+struct database_entry {
+    char *folder;
+    struct buffer deltas;
+};
+
+/* The union of what every database being written needs, rendered once */
+struct database_render {
+    struct pkg **pkgs;
+    struct database_entry *slots;
+    enum contents contents;
+    int poolfd;
 };
 
 struct database_writer {
     struct archive *archive;
     struct archive_entry *entry;
-    struct buffer buf;
+    const struct database_render *render;
     enum contents contents;
-    int poolfd;
+    const char *name;
+    int rootfd;
+    int fd;
 };
 
 /* The name, version and type fields all share the same memory */
@@ -44,30 +76,11 @@ struct entry_info {
     const char *version;
 };
 
-static char *sha256_fd(int fd)
+static double elapsed_since(const struct timespec *start)
 {
-    SHA256_CTX ctx;
-    unsigned char output[32];
-
-    SHA256_Init(&ctx);
-    for (;;) {
-        char buf[BUFSIZ];
-        ssize_t nbytes_r = read(fd, buf, sizeof(buf));
-        check_posix(nbytes_r, "failed to read file");
-        if (nbytes_r == 0)
-            break;
-        SHA256_Update(&ctx, buf, nbytes_r);
-    }
-    SHA256_Final(output, &ctx);
-
-    return hex_representation(output, sizeof(output));
-}
-
-static char *sha256_file(int dirfd, const char *filename)
-{
-    _cleanup_close_ int fd = openat(dirfd, filename, O_RDONLY);
-    check_posix(fd, "failed to open %s for sha256 checksum", filename);
-    return sha256_fd(fd);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
 }
 
 static int parse_database_pathname(const char *entryname, struct entry_info *entry)
@@ -99,25 +112,28 @@ static struct pkg *get_package(struct database_reader *db, struct entry_info *en
     struct pkg *pkg;
 
     if (db->likely_pkg) {
-        hash_t pkgname_hash = sdbm(entry_info->name);
+        hash_t pkgname_hash = strhash(entry_info->name);
         if (pkgname_hash == db->likely_pkg->hash && streq(db->likely_pkg->name, entry_info->name))
             return db->likely_pkg;
     }
 
     pkg = pkgcache_find(*pkgcache, entry_info->name);
     if (allocate && !pkg) {
-        pkg = malloc(sizeof(struct pkg));
+        struct arena *arena = &(*pkgcache)->arena;
+
+        pkg = arena_alloc(arena, sizeof(struct pkg));
         if (!pkg)
             return NULL;
 
         *pkg = (struct pkg){
-            .hash = sdbm(entry_info->name),
-            .name = strdup(entry_info->name),
-            .version = strdup(entry_info->version),
-            .mtime = db->mtime
+            .hash = strhash(entry_info->name),
+            .name = arena_strdup(arena, entry_info->name),
+            .version = arena_strdup(arena, entry_info->version),
+            .mtime = db->mtime,
+            .arena = arena
         };
 
-        *pkgcache = pkgcache_add_sorted(*pkgcache, pkg);
+        *pkgcache = pkgcache_add(*pkgcache, pkg);
     }
 
     if (pkg)
@@ -143,6 +159,104 @@ static bool is_database_metadata(const char *filename)
     return false;
 }
 
+static int read_raw_entry(struct archive *archive, struct raw_entry *raw)
+{
+    struct buffer buf = {0};
+
+    for (;;) {
+        char *block;
+        size_t block_len;
+
+        int status = archive_read(archive, &block, &block_len);
+        if (status == ARCHIVE_EOF)
+            break;
+        if (status != ARCHIVE_OK) {
+            buffer_release(&buf);
+            return -1;
+        }
+
+        buffer_append(&buf, block, block_len);
+    }
+
+    *raw = (struct raw_entry){ buf.data, buf.len };
+    return 0;
+}
+
+static int parse_desc(struct pkg *pkg, char *data, size_t len, uint64_t fields)
+{
+    struct desc_parser parser;
+    desc_parser_init(&parser);
+    parser.fields = fields;
+
+    return desc_parse(&parser, pkg, data, len) < 0 ? -1 : 0;
+}
+
+/* Parse the requested fields which were skipped when the package was
+ * loaded out of its raw desc entry */
+void database_materialize(struct pkg *pkg, uint64_t fields)
+{
+    fields &= pkg->lazy;
+
+    if (fields && pkg->raw_desc.data) {
+        if (parse_desc(pkg, pkg->raw_desc.data, pkg->raw_desc.len, fields) < 0)
+            errx(EXIT_FAILURE, "failed to parse desc for %s", pkg->name);
+    }
+
+    pkg->lazy &= ~fields;
+}
+
+/* The desc entry is about to be rendered again, so everything in it
+ * has to be parsed first */
+static void drop_raw_desc(struct pkg *pkg)
+{
+    database_materialize(pkg, PKG_ALL_FIELDS);
+    raw_entry_release(&pkg->raw_desc);
+}
+
+static bool has_depends(const struct pkg *pkg)
+{
+    return pkg->depends || pkg->conflicts || pkg->provides ||
+        pkg->optdepends || pkg->makedepends || pkg->checkdepends;
+}
+
+/* Hold on to the bytes of every entry so unchanged packages can be
+ * copied straight into the new database. Only the requested fields of
+ * desc are parsed, the rest of repose never looks at depends or files
+ * of a database package. */
+static int read_database_metadata(struct database_reader *db, const char *type,
+                                  struct pkg *pkg)
+{
+    struct raw_entry raw;
+    if (read_raw_entry(db->archive, &raw) < 0)
+        return -1;
+    db->bytes += raw.len;
+
+    if (streq(type, "desc")) {
+        const uint64_t fields = db->fields | depends_fields;
+
+        if (parse_desc(pkg, raw.data, raw.len, fields) < 0) {
+            free(raw.data);
+            return -1;
+        }
+
+        raw_entry_release(&pkg->raw_desc);
+        pkg->raw_desc = raw;
+        pkg->lazy = ~fields;
+
+        /* Dependencies in desc have to be rendered again to be split out */
+        if (has_depends(pkg))
+            drop_raw_desc(pkg);
+    } else if (streq(type, "depends")) {
+        raw_entry_release(&pkg->raw_depends);
+        pkg->raw_depends = raw;
+    } else if (streq(type, "files")) {
+        raw_entry_release(&pkg->raw_files);
+        pkg->raw_files = raw;
+    }
+
+    return 0;
+}
+
 static int parse_database_entry(struct database_reader *db, struct archive_entry *entry,
                                 struct pkgcache **pkgcache)
 {
@@ -164,7 +278,11 @@ static int parse_database_entry(struct database_reader *db, struct archive_entry
             goto cleanup;
         }
 
-        if (pkg && read_desc(db->archive, pkg) < 0) {
+        /* Everything we were asked for comes from the pathname */
+        if (!db->fields)
+            goto cleanup;
+
+        if (pkg && read_database_metadata(db, entry_info.type, pkg) < 0) {
             errx(EXIT_FAILURE, "failed to parse %s for %s", entry_info.type, pathname);
         }
     }
@@ -174,7 +292,11 @@ cleanup:
     return ret;
 }
 
-int load_database(int fd, struct pkgcache **pkgcache)
+/* Only the desc fields in the fields set are parsed up front, the rest
+ * are parsed on demand if the entry has to be rendered again. With no
+ * fields at all only the entry pathnames are read, which is enough to
+ * know each package's name and version. */
+int load_database(int fd, struct pkgcache **pkgcache, uint64_t fields)
 {
     int ret = 0;
 
@@ -184,17 +306,21 @@ int load_database(int fd, struct pkgcache **pkgcache)
     struct archive_entry *entry;
     struct database_reader db = {
         .archive = archive_read_new(),
-        .mtime = st.st_mtime
+        .mtime = st.st_mtime,
+        .fields = fields
     };
 
     archive_read_support_filter_all(db.archive);
     archive_read_support_format_all(db.archive);
 
-    if (archive_read_open_fd(db.archive, fd, 8192) != ARCHIVE_OK) {
+    if (archive_read_open_fd(db.archive, fd, 0x20000) != ARCHIVE_OK) {
         ret = -1;
         goto cleanup;
     }
 
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     while (archive_read_next_header(db.archive, &entry) == ARCHIVE_OK) {
         const mode_t mode = archive_entry_mode(entry);
 
@@ -204,6 +330,20 @@ int load_database(int fd, struct pkgcache **pkgcache)
         }
     }
 
+    pkgcache_sort(*pkgcache);
+
+    double elapsed = elapsed_since(&start);
+    trace("read %.1f MB of entries in %.2fs (%.1f MB/s)\n", db.bytes / 1e6,
+          elapsed, elapsed > 0 ? db.bytes / 1e6 / elapsed : 0.0);
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        trace("%.1f MB of packages in the arena, peak RSS %.1f MB\n",
+              (*pkgcache)->arena.used / 1e6, usage.ru_maxrss * 1024 / 1e6);
+    }
+    trace("%zu distinct values interned, %.1f MB saved by sharing them\n",
+          intern_count(), intern_saved() / 1e6);
+
 cleanup:
     archive_read_close(db.archive);
     archive_read_free(db.archive);
@@ -226,19 +366,18 @@ static void archive_entry_populate(struct archive_entry *e, unsigned int type,
 }
 
 static void commit_entry(struct database_writer *db, const char *name,
-                         const char *folder)
+                         const char *folder, const char *data, size_t len)
 {
-    if (!db->buf.len)
+    if (!len)
         return;
 
     _cleanup_free_ char *entrypath = joinstring(folder, "/", name, NULL);
 
     archive_entry_populate(db->entry, AE_IFREG, entrypath, 0644);
-    archive_entry_set_size(db->entry, db->buf.len);
+    archive_entry_set_size(db->entry, len);
     archive_write_header(db->archive, db->entry);
-    archive_write_data(db->archive, db->buf.data, db->buf.len);
+    archive_write_data(db->archive, data, len);
     archive_entry_clear(db->entry);
-    buffer_clear(&db->buf);
 }
 
 static void write_list(struct buffer *buf, const char *header, const alpm_list_t *lst)
@@ -276,138 +415,369 @@ static void write_time(struct buffer *buf, const char *header, time_t val)
     size_t: write_size, \
     time_t: write_time)(buf, header, val)
 
-static void compile_desc_entry(struct database_writer *db, struct pkg *pkg)
+void write_desc(struct buffer *buf, struct pkg *pkg)
 {
-    write_entry(&db->buf, "FILENAME",  pkg->filename);
-    write_entry(&db->buf, "NAME",      pkg->name);
-    write_entry(&db->buf, "BASE",      pkg->base);
-    write_entry(&db->buf, "VERSION",   pkg->version);
-    write_entry(&db->buf, "DESC",      pkg->desc);
-    write_entry(&db->buf, "GROUPS",    pkg->groups);
-    write_entry(&db->buf, "CSIZE",     pkg->size);
-    write_entry(&db->buf, "ISIZE",     pkg->isize);
+    write_entry(buf, "FILENAME",  pkg->filename);
+    write_entry(buf, "NAME",      pkg->name);
+    write_entry(buf, "BASE",      pkg->base);
+    write_entry(buf, "VERSION",   pkg->version);
+    write_entry(buf, "DESC",      pkg->desc);
+    write_entry(buf, "GROUPS",    pkg->groups);
+    write_entry(buf, "CSIZE",     pkg->size);
+    write_entry(buf, "ISIZE",     pkg->isize);
 
     if (pkg->base64sig) {
-        write_entry(&db->buf, "PGPSIG", pkg->base64sig);
+        write_entry(buf, "PGPSIG", pkg->base64sig);
     } else {
-        if (!pkg->sha256sum)
-            pkg->sha256sum = sha256_file(db->poolfd, pkg->filename);
-        write_entry(&db->buf, "SHA256SUM", pkg->sha256sum);
+        write_entry(buf, "SHA256SUM", pkg->sha256sum);
     }
 
-    write_entry(&db->buf, "URL",       pkg->url);
-    write_entry(&db->buf, "LICENSE",   pkg->licenses);
-    write_entry(&db->buf, "ARCH",      pkg->arch);
-    write_entry(&db->buf, "BUILDDATE", pkg->builddate);
-    write_entry(&db->buf, "PACKAGER",  pkg->packager);
-    write_entry(&db->buf, "REPLACES",  pkg->replaces);
+    write_entry(buf, "URL",       pkg->url);
+    write_entry(buf, "LICENSE",   pkg->licenses);
+    write_entry(buf, "ARCH",      pkg->arch);
+    write_entry(buf, "BUILDDATE", pkg->builddate);
+    write_entry(buf, "PACKAGER",  pkg->packager);
+    write_entry(buf, "REPLACES",  pkg->replaces);
 }
 
-static void compile_depends_entry(struct database_writer *db, struct pkg *pkg)
+void write_depends(struct buffer *buf, struct pkg *pkg)
 {
-    write_entry(&db->buf, "DEPENDS",      pkg->depends);
-    write_entry(&db->buf, "CONFLICTS",    pkg->conflicts);
-    write_entry(&db->buf, "PROVIDES",     pkg->provides);
-    write_entry(&db->buf, "OPTDEPENDS",   pkg->optdepends);
-    write_entry(&db->buf, "MAKEDEPENDS",  pkg->makedepends);
-    write_entry(&db->buf, "CHECKDEPENDS", pkg->checkdepends);
+    write_entry(buf, "DEPENDS",      pkg->depends);
+    write_entry(buf, "CONFLICTS",    pkg->conflicts);
+    write_entry(buf, "PROVIDES",     pkg->provides);
+    write_entry(buf, "OPTDEPENDS",   pkg->optdepends);
+    write_entry(buf, "MAKEDEPENDS",  pkg->makedepends);
+    write_entry(buf, "CHECKDEPENDS", pkg->checkdepends);
+}
+
+static void compile_desc_entry(int poolfd, struct buffer *buf, struct pkg *pkg)
+{
+    if (!pkg->base64sig && !pkg->sha256sum) {
+        pkg->sha256sum = sha256_file(poolfd, pkg->filename, config.checksum_xattr, NULL);
+        pkg->owned |= PKG_FIELD(PKG_SHA256SUM);
+    }
+
+    write_desc(buf, pkg);
 }
 
-static void compile_files_entry(struct database_writer *db, struct pkg *pkg)
+static void compile_depends_entry(struct buffer *buf, struct pkg *pkg)
+{
+    write_depends(buf, pkg);
+}
+
+static void compile_files_entry(int poolfd, struct buffer *buf, struct pkg *pkg)
 {
     if (!pkg->files) {
-        _cleanup_close_ int pkgfd = openat(db->poolfd, pkg->filename, O_RDONLY);
+        _cleanup_close_ int pkgfd = openat(poolfd, pkg->filename, O_RDONLY);
         if (pkgfd < 0 && errno != ENOENT)
             err(EXIT_FAILURE, "failed to open %s", pkg->filename);
 
         load_package_files(pkg, pkgfd);
     }
 
-    write_entry(&db->buf, "FILES", pkg->files);
+    write_entry(buf, "FILES", pkg->files);
 }
 
-static void compile_database_entry(struct database_writer *db, struct pkg *pkg)
+/* The package takes over what was rendered. The writers read it from
+ * there, and it's kept so the package can be snapshotted as it now
+ * appears in the database. */
+static void keep_rendered(struct raw_entry *raw, struct buffer *buf)
 {
-    _cleanup_free_ char *folder = joinstring(pkg->name, "-", pkg->version, NULL);
+    if (buf->len) {
+        *raw = (struct raw_entry){ .data = buf->data, .len = buf->len };
+    } else {
+        buffer_release(buf);
+    }
+}
+
+/* Runs on the worker threads. Each package only touches its own slot,
+ * so rendering entries, and loading file lists, can happen in parallel */
+static void render_database_entry(void *data, size_t idx, size_t slot)
+{
+    struct database_render *render = data;
+    struct database_entry *entry = &render->slots[slot];
+    struct pkg *pkg = render->pkgs[idx];
+
+    free(entry->folder);
+    buffer_clear(&entry->deltas);
 
-    archive_entry_populate(db->entry, AE_IFDIR, folder, 0755);
+    entry->folder = joinstring(pkg->name, "-", pkg->version, NULL);
+
+    if (render->contents & DB_DESC && !pkg->raw_desc.data) {
+        struct buffer buf = {0};
+        compile_desc_entry(render->poolfd, &buf, pkg);
+        keep_rendered(&pkg->raw_desc, &buf);
+    }
+    if (render->contents & DB_DEPENDS && !pkg->raw_depends.data) {
+        struct buffer buf = {0};
+        compile_depends_entry(&buf, pkg);
+        keep_rendered(&pkg->raw_depends, &buf);
+    }
+    if (render->contents & DB_FILES && !pkg->raw_files.data) {
+        struct buffer buf = {0};
+        compile_files_entry(render->poolfd, &buf, pkg);
+        keep_rendered(&pkg->raw_files, &buf);
+    }
+    if (render->contents & DB_DELTAS)
+        write_entry(&entry->deltas, "DELTAS", pkg->deltas);
+}
+
+/* Each database gets its own writer thread which sees the packages in
+ * order, so the archive comes out the same no matter how many jobs
+ * rendered it. The slot is shared between writers, so only read it. */
+static void write_database_entry(void *data, size_t idx, size_t slot)
+{
+    struct database_writer *db = data;
+    struct database_entry *entry = &db->render->slots[slot];
+    const struct pkg *pkg = db->render->pkgs[idx];
+
+    archive_entry_populate(db->entry, AE_IFDIR, entry->folder, 0755);
     archive_write_header(db->archive, db->entry);
     archive_entry_clear(db->entry);
 
-    if (db->contents & DB_DESC) {
-        compile_desc_entry(db, pkg);
-        commit_entry(db, "desc", folder);
+    if (db->contents & DB_DESC)
+        commit_entry(db, "desc", entry->folder, pkg->raw_desc.data, pkg->raw_desc.len);
+    if (db->contents & DB_DEPENDS)
+        commit_entry(db, "depends", entry->folder, pkg->raw_depends.data, pkg->raw_depends.len);
+    if (db->contents & DB_FILES)
+        commit_entry(db, "files", entry->folder, pkg->raw_files.data, pkg->raw_files.len);
+    if (db->contents & DB_DELTAS)
+        commit_entry(db, "deltas", entry->folder, entry->deltas.data, entry->deltas.len);
+}
+
+struct ingest_job {
+    int poolfd;
+    int contents;
+    struct pkg **pkgs;
+    size_t *hashed;
+};
+
+static int missing_contents(const struct pkg *pkg, int contents)
+{
+    int flags = 0;
+    if (contents & DB_DESC && !pkg->base64sig && !pkg->sha256sum)
+        flags |= LOAD_SHA256;
+    if (contents & DB_FILES && !pkg->raw_files.data && !pkg->files)
+        flags |= LOAD_FILES;
+    return flags;
+}
+
+static void ingest_package(void *data, size_t idx)
+{
+    struct ingest_job *job = data;
+    struct pkg *pkg = job->pkgs[idx];
+
+    _cleanup_close_ int fd = openat(job->poolfd, pkg->filename, O_RDONLY);
+    check_posix(fd, "failed to open %s", pkg->filename);
+
+    int flags = missing_contents(pkg, job->contents);
+    const bool checksum = flags & LOAD_SHA256;
+    if (checksum && config.checksum_xattr) {
+        pkg->sha256sum = checksum_xattr_get(fd);
+        pkg->owned |= PKG_FIELD(PKG_SHA256SUM);
+        if (pkg->sha256sum)
+            flags &= ~LOAD_SHA256;
+    }
+
+    if (flags && load_package_contents(pkg, fd, flags) < 0 && flags & LOAD_SHA256) {
+        /* Not readable as a package anymore, but it still gets a
+         * checksum like any other file */
+        check_posix(lseek(fd, 0, SEEK_SET), "failed to lseek");
+        pkg->sha256sum = sha256_fd(fd, NULL);
+        pkg->owned |= PKG_FIELD(PKG_SHA256SUM);
     }
-    if (db->contents & DB_DEPENDS) {
-        compile_depends_entry(db, pkg);
-        commit_entry(db, "depends", folder);
+
+    if (flags & LOAD_SHA256) {
+        struct stat st;
+        if (fstat(fd, &st) == 0)
+            job->hashed[idx] = st.st_size;
+        if (config.checksum_xattr)
+            checksum_xattr_set(fd, pkg->sha256sum);
     }
-    if (db->contents & DB_FILES) {
-        compile_files_entry(db, pkg);
-        commit_entry(db, "files", folder);
+
+    /* The desc we read is missing the checksum, so it has to be
+     * rendered again */
+    if (checksum)
+        drop_raw_desc(pkg);
+}
+
+/* Read whatever the databases need and the scan didn't collect, which
+ * is the checksum of unsigned packages and the file list for the files
+ * database. Only added or updated packages are missing either, and
+ * each is read once, in parallel, rather than one piece at a time on
+ * the thread that's formatting and compressing the database. */
+static void ingest_packages(struct repo *repo, int contents)
+{
+    struct ingest_job job = { .poolfd = repo->poolfd, .contents = contents };
+    size_t count = 0, len = 0;
+
+    struct pkg *pkg;
+    pkgcache_foreach(repo->cache, pkg) {
+        if (!missing_contents(pkg, contents))
+            continue;
+
+        if (count == len) {
+            len = len ? len * 2 : 64;
+            job.pkgs = realloc(job.pkgs, len * sizeof(struct pkg *));
+            check_null(job.pkgs, "failed to allocate ingest queue");
+        }
+        job.pkgs[count++] = pkg;
     }
-    if (db->contents & DB_DELTAS) {
-        write_entry(&db->buf, "DELTAS", pkg->deltas);
-        commit_entry(db, "deltas", folder);
+
+    if (count == 0) {
+        free(job.pkgs);
+        return;
     }
+
+    job.hashed = calloc(count, sizeof(size_t));
+    check_null(job.hashed, "failed to allocate ingest queue");
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    parallel_for(config.jobs, count, ingest_package, &job);
+    double elapsed = elapsed_since(&start);
+
+    size_t hashed = 0;
+    for (size_t i = 0; i < count; ++i)
+        hashed += job.hashed[i];
+
+    trace("read %zu packages, checksummed %.1f MB in %.2fs (%.1f MB/s)\n",
+          count, hashed / 1e6, elapsed, elapsed > 0 ? hashed / 1e6 / elapsed : 0.0);
+
+    free(job.hashed);
+    free(job.pkgs);
 }
 
-static int compile_database(struct repo *repo, const char *repo_name,
-                            enum contents what)
+static int open_database_archive(struct archive *archive, int fd)
 {
-    int ret = 0;
-    _cleanup_close_ int dbfd = openat(repo->rootfd, repo_name,
-                                      O_CREAT | O_WRONLY | O_TRUNC, 0644);
-    if (dbfd < 0)
-        return -1;
+    char value[16];
+
+    /* libarchive's gzip filter is single threaded, so write independent
+     * gzip members in parallel ourselves instead */
+    if (config.compression == ARCHIVE_FILTER_GZIP && config.jobs > 1)
+        return archive_write_open_pgzip(archive, fd, config.jobs, config.compression_level);
+
+    archive_write_add_filter(archive, config.compression);
 
-    struct database_writer db = {
+    if (config.compression_level >= 0) {
+        snprintf(value, sizeof(value), "%d", config.compression_level);
+        if (archive_write_set_filter_option(archive, NULL, "compression-level", value) < ARCHIVE_WARN)
+            errx(EXIT_FAILURE, "invalid compression level %d: %s",
+                 config.compression_level, archive_error_string(archive));
+    }
+
+    /* Best effort, older libarchive builds may not support threads */
+    if (config.jobs > 1 && (config.compression == ARCHIVE_FILTER_XZ ||
+                            config.compression == ARCHIVE_FILTER_ZSTD)) {
+        snprintf(value, sizeof(value), "%d", config.jobs);
+        archive_write_set_filter_option(archive, NULL, "threads", value);
+    }
+
+    return archive_write_open_fd(archive, fd);
+}
+
+static void open_database(struct database_writer *db, struct repo *repo,
+                          const char *repo_name, enum contents what)
+{
+    trace("writing %s...\n", repo_name);
+
+    *db = (struct database_writer){
         .archive = archive_write_new(),
         .entry = archive_entry_new(),
-        .buf = {0},
         .contents = what,
-        .poolfd = repo->poolfd,
+        .name = repo_name,
+        .rootfd = repo->rootfd,
+        .fd = openat(repo->rootfd, repo_name, O_CREAT | O_WRONLY | O_TRUNC, 0644),
     };
 
-    archive_write_add_filter(db.archive, config.compression);
-    archive_write_set_format_pax_restricted(db.archive);
+    check_posix(db->fd, "failed to write %s database", repo_name);
 
-    if (archive_write_open_fd(db.archive, dbfd) < 0) {
-        ret = -1;
-        goto cleanup;
-    }
+    archive_write_set_format_pax_restricted(db->archive);
+    if (open_database_archive(db->archive, db->fd) < 0)
+        errx(EXIT_FAILURE, "failed to write %s database: %s", repo_name,
+             archive_error_string(db->archive));
 
-    archive_entry_populate(db.entry, AE_IFDIR, "", 0755);
-    archive_write_header(db.archive, db.entry);
-    archive_entry_clear(db.entry);
+    archive_entry_populate(db->entry, AE_IFDIR, "", 0755);
+    archive_write_header(db->archive, db->entry);
+    archive_entry_clear(db->entry);
+}
 
-    /* The files database can get very, very large. Lets allocate a
-     * 2MiB buffer so we have plenty of room and avoid reallocation. */
-    buffer_reserve(&db.buf, 0x200000);
+/* Runs on the database's writer thread as soon as its last entry is
+ * written, so a finished database can be signed while others are still
+ * being compressed */
+static void finish_database(void *data)
+{
+    struct database_writer *db = data;
 
-    const alpm_list_t *node;
-    for (node = repo->cache->list; node; node = node->next) {
-        struct pkg *pkg = node->data;
-        compile_database_entry(&db, pkg);
-    }
+    if (archive_write_close(db->archive) < 0)
+        errx(EXIT_FAILURE, "failed to write %s database: %s", db->name,
+             archive_error_string(db->archive));
 
-    archive_write_close(db.archive);
-    buffer_release(&db.buf);
+    archive_entry_free(db->entry);
+    archive_write_free(db->archive);
+    close(db->fd);
 
-cleanup:
-    archive_entry_free(db.entry);
-    archive_write_free(db.archive);
-    return ret;
+    if (config.sign)
+        gpgme_sign(db->rootfd, db->name, NULL);
 }
 
-int write_database(struct repo *repo, const char *repo_name, enum contents what)
+/* Write the package database and, if requested, the files database in
+ * a single pass over the cache. Each package is rendered once and then
+ * fed to both archives, which are compressed concurrently. */
+int write_databases(struct repo *repo)
 {
-    trace("writing %s...\n", repo_name);
-    check_posix(compile_database(repo, repo_name, what),
-                "failed to write %s database", repo_name);
+    struct database_writer dbs[2];
+    struct pipeline_consumer consumers[2];
+    size_t ndbs = 0;
 
-    if (config.sign)
-        gpgme_sign(repo->rootfd, repo_name, NULL);
+    struct database_render render = {
+        .poolfd = repo->poolfd,
+    };
+
+    open_database(&dbs[ndbs++], repo, repo->dbname, DB_DESC | DB_DEPENDS);
+    if (repo->filesname)
+        open_database(&dbs[ndbs++], repo, repo->filesname, DB_FILES);
+
+    for (size_t i = 0; i < ndbs; ++i) {
+        dbs[i].render = &render;
+        render.contents |= dbs[i].contents;
+        consumers[i] = (struct pipeline_consumer){
+            .consume = write_database_entry,
+            .finish = finish_database,
+            .data = &dbs[i],
+        };
+    }
+
+    /* Packages added or replaced since loading were appended, but the
+     * database should be written in name order */
+    pkgcache_sort(repo->cache);
+
+    ingest_packages(repo, render.contents);
+
+    size_t count = repo->cache->entries;
+    size_t window = config.jobs > 1 ? (size_t)config.jobs * 4 : 1;
+
+    render.pkgs = malloc(count * sizeof(struct pkg *));
+    render.slots = calloc(window, sizeof(struct database_entry));
+    check_null(render.pkgs, "failed to allocate database writer");
+    check_null(render.slots, "failed to allocate database writer");
+
+    size_t i = 0;
+    struct pkg *pkg;
+    pkgcache_foreach(repo->cache, pkg)
+        render.pkgs[i++] = pkg;
+
+    parallel_pipeline(config.jobs, count, window, render_database_entry, &render,
+                      consumers, ndbs);
+
+    for (i = 0; i < window; ++i) {
+        free(render.slots[i].folder);
+        buffer_release(&render.slots[i].deltas);
+    }
+    free(render.slots);
+    free(render.pkgs);
 
+    trace("%zu distinct values interned, %.1f MB saved by sharing them\n",
+          intern_count(), intern_saved() / 1e6);
     return 0;
 }
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <stdint.h>
 #include "pkgcache.h"
 
 struct repo;
+struct buffer;
 
 enum contents {
     DB_DESC    = 1,
@@ -11,5 +13,9 @@ enum contents {
     DB_DELTAS  = 1 << 4
 };
 
-int load_database(int fd, struct pkgcache **pkgcache);
-int write_database(struct repo *repo, const char *repo_name, enum contents what);
+int load_database(int fd, struct pkgcache **pkgcache, uint64_t fields);
+int write_databases(struct repo *repo);
+void database_materialize(struct pkg *pkg, uint64_t fields);
+
+void write_desc(struct buffer *buf, struct pkg *pkg);
+void write_depends(struct buffer *buf, struct pkg *pkg);
@@ -1,26 +1,34 @@
 #include "desc.h"
 
+#include <stdbool.h>
+#include <string.h>
 #include <err.h>
 #include "package.h"
+#include "scan.h"
 #include "util.h"
 
 %%{
     machine desc;
 
-    action store {
-        parser->store[parser->pos++] = fc;
-        if (parser->pos == LINE_MAX) {
-            errx(1, "desc line too long");
-        }
+    action mark {
+        parser->mark = fpc;
     }
 
     action emit {
-        const char *entry = parser->store;
-        const size_t entry_len = parser->pos;
-        parser->store[parser->pos] = 0;
-        parser->pos = 0;
+        const char *entry = parser->mark;
+        size_t entry_len = fpc - parser->mark;
+
+        /* The value started in an earlier block */
+        if (parser->pos) {
+            desc_parser_carry(parser, entry, entry_len);
+            entry = parser->store;
+            entry_len = parser->pos;
+            parser->pos = 0;
+        }
+        parser->mark = NULL;
 
-        package_set(pkg, parser->entry, entry, entry_len);
+        if (parser->fields & PKG_FIELD(parser->entry))
+            package_set(pkg, parser->entry, entry, entry_len);
     }
 
     header = '%FILENAME%'     %{ parser->entry = PKG_FILENAME; }
@@ -49,26 +57,41 @@
            | '%DELTAS%'       %{ parser->entry = PKG_FILES; };
 
       section = header '\n';
-      contents = [^%\n]+ @store %emit '\n';
+      contents = [^%\n]+ >mark %emit '\n';
 
       main := ( section contents* '\n' | '\n' )*;
 }%%
 
 %%write data nofinal;
 
+static void desc_parser_carry(struct desc_parser *parser, const char *p, size_t len)
+{
+    if (parser->pos + len >= LINE_MAX)
+        errx(1, "desc line too long");
+
+    memcpy(&parser->store[parser->pos], p, len);
+    parser->pos += len;
+}
+
 void desc_parser_init(struct desc_parser *parser)
 {
-    *parser = (struct desc_parser){0};
+    *parser = (struct desc_parser){ .fields = PKG_ALL_FIELDS };
     %%access parser->;
     %%write init;
 }
 
+/* Values are handed to package_set() as spans straight out of buf. Only
+ * a value that's cut off by the end of buf gets copied, so it can be
+ * completed by the next call. */
 ssize_t desc_parser_feed(struct desc_parser *parser, struct pkg *pkg,
                          char *buf, size_t buf_len)
 {
     char *p = buf;
     char *pe = p + buf_len;
 
+    if (parser->pos)
+        parser->mark = p;
+
     %%access parser->;
     %%write exec;
 
@@ -76,29 +99,53 @@ ssize_t desc_parser_feed(struct desc_parser *parser, struct pkg *pkg,
     if (parser->cs == desc_error)
         return -1;
 
+    if (parser->mark) {
+        desc_parser_carry(parser, parser->mark, pe - parser->mark);
+        parser->mark = NULL;
+    }
+
     return buf_len;
 }
 
-ssize_t read_desc(struct archive *archive, struct pkg *pkg)
+/* Parse a complete desc entry. Lines are found with the vectorized
+ * scanner and values within a section are handed straight to
+ * package_set(). Headers, blank lines and anything unusual still go
+ * through the state machine, so the result is the same as feeding the
+ * whole buffer to desc_parser_feed(). */
+ssize_t desc_parse(struct desc_parser *parser, struct pkg *pkg,
+                   char *buf, size_t buf_len)
 {
-    char *buf;
-    ssize_t nbytes_r = 0;
-    struct desc_parser parser;
-    desc_parser_init(&parser);
-
-    for (;;) {
-        size_t bufsize;
-        archive_read(archive, &buf, &bufsize);
-
-        ssize_t result = desc_parser_feed(&parser, pkg, buf, bufsize);
-        if (result < 0) {
-            return result;
-        } else {
-            nbytes_r += result;
+    char *p = buf;
+    char *pe = p + buf_len;
+    bool in_section = false;
+
+    while (p < pe) {
+        if (*p == '%' || *p == '\n' || !in_section) {
+            char *eol = p + (scan_line(p, pe) - p);
+            if (eol < pe)
+                ++eol;
+
+            if (desc_parser_feed(parser, pkg, p, eol - p) < 0)
+                return -1;
+
+            in_section = *p == '%';
+            p = eol;
+            continue;
+        }
+
+        char *eol = p + (scan_value(p, pe) - p);
+        if (eol == pe || *eol == '%') {
+            /* Let the state machine carry an unterminated value, or
+             * reject a stray '%' */
+            if (desc_parser_feed(parser, pkg, p, pe - p) < 0)
+                return -1;
+            break;
         }
 
-        break;
+        if (parser->fields & PKG_FIELD(parser->entry))
+            package_set(pkg, parser->entry, p, eol - p);
+        p = eol + 1;
     }
 
-    return nbytes_r;
+    return buf_len;
 }
@@ -8,13 +8,38 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <errno.h>
+#include <err.h>
 #include <alpm.h>
 
+#include "repose.h"
 #include "package.h"
 #include "pkgcache.h"
 #include "filters.h"
+#include "parallel.h"
+#include "scancache.h"
+#include "version.h"
 #include "util.h"
 
+/* Files which share a name and architecture, newest version first */
+struct scan_group {
+    size_t *members;
+    size_t count;
+};
+
+struct scan_job {
+    int dirfd;
+    char **filenames;
+    struct pkg_filename *names;
+    struct pkg **pkgs;
+    struct buffer *records;
+    const struct scancache *scancache;
+    struct scan_group *groups;
+    size_t *members;
+    size_t ngroups;
+    alpm_list_t *targets;
+    const char *arch;
+};
+
 static inline bool is_file(int d_type)
 {
     return d_type == DT_REG || d_type == DT_UNKNOWN;
@@ -27,7 +52,7 @@ static inline struct pkgcache *filecache_add(struct pkgcache *cache, struct pkg
         return pkgcache_add(cache, pkg);
     }
 
-    int vercmp = alpm_pkg_vercmp(pkg->version, old->version);
+    int vercmp = pkg_vercmp(pkg, old);
     if (vercmp == 0 || vercmp == 1) {
         return pkgcache_replace(cache, pkg, old);
     }
@@ -35,21 +60,49 @@ static inline struct pkgcache *filecache_add(struct pkgcache *cache, struct pkg
     return cache;
 }
 
-static size_t get_filecache_size(DIR *dirp)
+/* Symlinks are never scanned, but one which resolves still counts as
+ * present when the database is synced against the listing, the same
+ * as faccessat() would have it */
+static bool is_live_link(DIR *dirp, const struct dirent *dp)
+{
+    return dp->d_type == DT_LNK && faccessat(dirfd(dirp), dp->d_name, F_OK, 0) == 0;
+}
+
+/* Regular files come first, the first nfiles entries, followed by any
+ * symlinks */
+static char **read_pool(DIR *dirp, size_t *count, size_t *nfiles)
 {
     struct dirent *dp;
-    size_t size = 0;
+    size_t size = 0, files = 0, buflen = 64;
+    char **filenames = malloc(buflen * sizeof(char *));
+    check_null(filenames, "failed to allocate pool listing");
 
     for (dp = readdir(dirp); dp; dp = readdir(dirp)) {
-        if (is_file(dp->d_type))
-            ++size;
+        const bool file = is_file(dp->d_type);
+        if (!file && !is_live_link(dirp, dp))
+            continue;
+
+        if (size == buflen) {
+            buflen *= 2;
+            filenames = realloc(filenames, buflen * sizeof(char *));
+            check_null(filenames, "failed to allocate pool listing");
+        }
+        filenames[size] = strdup(dp->d_name);
+        check_null(filenames[size++], "failed to allocate pool listing");
+
+        if (file) {
+            char *first_link = filenames[files];
+            filenames[files++] = filenames[size - 1];
+            filenames[size - 1] = first_link;
+        }
     }
 
-    rewinddir(dirp);
-    return size;
+    *count = size;
+    *nfiles = files;
+    return filenames;
 }
 
-static struct pkg *load_from_file(int dirfd, const char *filename)
+static struct pkg *load_from_file(int dirfd, const char *filename, bool *invalid)
 {
     _cleanup_close_ int pkgfd = openat(dirfd, filename, O_RDONLY);
     check_posix(pkgfd, "failed to open %s", filename);
@@ -57,12 +110,16 @@ static struct pkg *load_from_file(int dirfd, const char *filename)
     struct pkg *pkg = malloc(sizeof(pkg_t));
     *pkg = (struct pkg){ .filename = strdup(filename) };
 
-    if (load_package(pkg, pkgfd) < 0) {
+    if (load_package_signature(pkg, dirfd) < 0 && errno != ENOENT) {
         package_free(pkg);
         return NULL;
     }
 
-    if (load_package_signature(pkg, dirfd) < 0 && errno != ENOENT) {
+    /* Only .PKGINFO is read here. Checksums and file lists are only
+     * needed for packages which end up added or updated, and the
+     * database writer reads those in a single pass. */
+    if (load_package(pkg, pkgfd, 0) < 0) {
+        *invalid = true;
         package_free(pkg);
         return NULL;
     }
@@ -70,36 +127,294 @@ static struct pkg *load_from_file(int dirfd, const char *filename)
     return pkg;
 }
 
-static struct pkgcache *scan_for_targets(struct pkgcache *cache, int dirfd, DIR *dirp,
-                                        alpm_list_t *targets, const char *arch)
+static struct pkg *load_cached(struct scan_job *job, size_t idx)
 {
-    const struct dirent *dp;
+    const char *filename = job->filenames[idx];
+    struct scan_key key;
 
-    for (dp = readdir(dirp); dp; dp = readdir(dirp)) {
-        if (!is_file(dp->d_type))
-            continue;
-
-        struct pkg *pkg = load_from_file(dirfd, dp->d_name);
-        if (!pkg)
-            continue;
+    if (scan_key_stat(job->dirfd, filename, &key) < 0)
+        return NULL;
 
-        if (targets && !match_targets(pkg, targets)) {
-            package_free(pkg);
-            continue;
+    /* Files which are unchanged since the last scan can be pulled
+     * straight from the scan cache, including ones we already know
+     * aren't packages. */
+    const struct scan_record *record = scancache_find(job->scancache, filename, &key);
+    if (record) {
+        struct pkg *pkg = record->invalid ? NULL : scancache_get_pkg(record);
+        if (pkg || record->invalid) {
+            buffer_append(&job->records[idx], record->raw, record->raw_len);
+            return pkg;
         }
+    }
 
-        if (arch && !match_arch(pkg, arch)) {
-            package_free(pkg);
-            continue;
+    bool invalid = false;
+    struct pkg *pkg = load_from_file(job->dirfd, filename, &invalid);
+    if (pkg || invalid)
+        scancache_render(&job->records[idx], filename, &key, pkg);
+    return pkg;
+}
+
+static struct pkg *scan_file(struct scan_job *job, size_t idx)
+{
+    struct pkg *pkg;
+
+    if (job->records) {
+        pkg = load_cached(job, idx);
+    } else {
+        bool invalid = false;
+        pkg = load_from_file(job->dirfd, job->filenames[idx], &invalid);
+    }
+
+    if (pkg && job->targets && !match_targets(pkg, job->targets)) {
+        package_free(pkg);
+        pkg = NULL;
+    }
+
+    if (pkg && job->arch && !match_arch(pkg, job->arch)) {
+        package_free(pkg);
+        pkg = NULL;
+    }
+
+    return pkg;
+}
+
+/* Whether the package really is what its filename claims to be */
+static bool matches_filename(const struct pkg *pkg, const struct pkg_filename *info)
+{
+    return pkg->version && pkg->arch && streq(pkg->name, info->name) &&
+           streq(pkg->version, info->version) && streq(pkg->arch, info->arch);
+}
+
+static void scan_group(void *data, size_t idx)
+{
+    struct scan_job *job = data;
+    const struct scan_group *group = &job->groups[idx];
+
+    /* Load the newest version, along with anything tied with it. Only
+     * if none of them turn out to be usable do we have to fall back
+     * to the next newest version. A package which doesn't match its
+     * filename isn't usable for this purpose either: it's kept, but
+     * the next version down is loaded too.
+     *
+     * This trusts that the older names in a group really hold older
+     * packages. A file which is named as an older version than the
+     * one it contains is never opened, unlike with a full scan. */
+    for (size_t i = 0; i < group->count;) {
+        const struct version_key *version = job->names[group->members[i]].vkey;
+        bool found = false;
+
+        do {
+            size_t member = group->members[i++];
+            job->pkgs[member] = scan_file(job, member);
+            found |= job->pkgs[member] &&
+                     matches_filename(job->pkgs[member], &job->names[member]);
+        } while (i < group->count && version &&
+                 version_key_cmp(version, job->names[group->members[i]].vkey) == 0);
+
+        if (found)
+            break;
+    }
+}
+
+static int candidate_cmp(const void *p1, const void *p2, void *arg)
+{
+    const struct pkg_filename *names = arg;
+    const size_t idx1 = *(const size_t *)p1;
+    const size_t idx2 = *(const size_t *)p2;
+    const struct pkg_filename *n1 = &names[idx1];
+    const struct pkg_filename *n2 = &names[idx2];
+
+    int ret = strcmp(n1->name, n2->name);
+    if (ret == 0)
+        ret = strcmp(n1->arch, n2->arch);
+    if (ret == 0)
+        ret = version_key_cmp(n2->vkey, n1->vkey);
+    if (ret == 0)
+        ret = idx1 < idx2 ? -1 : idx1 > idx2;
+    return ret;
+}
+
+enum file_class {
+    FILE_SKIP,
+    FILE_PACKAGE,
+    FILE_UNKNOWN
+};
+
+static bool is_repo_metadata(const char *filename)
+{
+    static const char *metadata_suffixes[] = {
+        ".sig",
+        ".db",
+        ".files",
+        ".manifest",
+        ".scancache",
+        ".repose-index",
+        ".log",
+        ".part",
+        ".tmp",
+        ".old",
+        NULL
+    };
+
+    if (strstr(filename, ".db.tar") || strstr(filename, ".files.tar"))
+        return true;
+
+    const size_t len = strlen(filename);
+    for (const char **n = metadata_suffixes; *n; ++n) {
+        const size_t suffix_len = strlen(*n);
+        if (len > suffix_len && streq(filename + len - suffix_len, *n))
+            return true;
+    }
+
+    return false;
+}
+
+/* Decide what to do with a file from its name alone, before we spend a
+ * syscall on it. Packages whose name, version or architecture can't
+ * possibly pass the filters are never opened. */
+static enum file_class classify_file(struct scan_job *job, size_t idx)
+{
+    const char *filename = job->filenames[idx];
+    struct pkg_filename *info = &job->names[idx];
+
+    if (parse_package_filename(filename, info) < 0)
+        return is_repo_metadata(filename) ? FILE_SKIP : FILE_UNKNOWN;
+
+    struct pkg pkg = {
+        .filename = job->filenames[idx],
+        .name = info->name,
+        .version = info->version,
+        .arch = info->arch
+    };
+
+    if (job->arch && !match_arch(&pkg, job->arch))
+        return FILE_SKIP;
+    if (job->targets && !match_targets(&pkg, job->targets))
+        return FILE_SKIP;
+
+    /* Candidates get sorted by version, parse it just the once */
+    info->vkey = version_key_new(info->version);
+    return FILE_PACKAGE;
+}
+
+/* Pools tend to keep many old builds of each package around. Use the
+ * versions encoded in the filenames to group them up, so that we only
+ * need to open the newest one. Anything we can't make sense of
+ * from the name alone is loaded unconditionally. */
+static void plan_scan(struct scan_job *job, size_t count)
+{
+    job->names = calloc(count, sizeof(struct pkg_filename));
+    job->members = malloc(count * sizeof(size_t));
+    job->groups = malloc(count * sizeof(struct scan_group));
+    if (!job->names || !job->members || !job->groups)
+        err(EXIT_FAILURE, "failed to allocate scan plan");
+
+    size_t nsorted = 0, nfallback = 0;
+    for (size_t i = 0; i < count; ++i) {
+        switch (classify_file(job, i)) {
+        case FILE_PACKAGE:
+            job->members[nsorted++] = i;
+            break;
+        case FILE_UNKNOWN:
+            job->members[count - ++nfallback] = i;
+            break;
+        case FILE_SKIP:
+            pkg_filename_free(&job->names[i]);
+            break;
         }
+    }
+
+    qsort_r(job->members, nsorted, sizeof(size_t), candidate_cmp, job->names);
 
-        cache = filecache_add(cache, pkg);
+    for (size_t i = 0; i < nsorted;) {
+        struct scan_group *group = &job->groups[job->ngroups++];
+        const struct pkg_filename *first = &job->names[job->members[i]];
+
+        *group = (struct scan_group){ .members = &job->members[i] };
+        do {
+            ++group->count;
+            ++i;
+        } while (i < nsorted &&
+                 streq(first->name, job->names[job->members[i]].name) &&
+                 streq(first->arch, job->names[job->members[i]].arch));
     }
 
+    for (size_t i = count - nfallback; i < count; ++i) {
+        job->groups[job->ngroups++] = (struct scan_group){
+            .members = &job->members[i],
+            .count = 1
+        };
+    }
+}
+
+static struct pkgcache *scan_for_targets(struct pkgcache *cache, int dirfd,
+                                         char **filenames, size_t count,
+                                         struct scancache *scancache,
+                                         alpm_list_t *targets, const char *arch)
+{
+    struct scan_job job = {
+        .dirfd = dirfd,
+        .filenames = filenames,
+        .pkgs = calloc(count, sizeof(struct pkg *)),
+        .scancache = scancache,
+        .targets = targets,
+        .arch = arch
+    };
+    check_null(job.pkgs, "failed to allocate scan results");
+
+    if (scancache) {
+        job.records = calloc(count, sizeof(struct buffer));
+        check_null(job.records, "failed to allocate scan results");
+    }
+
+    plan_scan(&job, count);
+
+    /* Loading is the expensive part and each group is independent, so
+     * fan it out. Merging happens afterwards in directory order so
+     * the result is identical to a serial scan. */
+    parallel_for(config.jobs, job.ngroups, scan_group, &job);
+
+    for (size_t i = 0; i < count; ++i) {
+        if (job.pkgs[i])
+            cache = filecache_add(cache, job.pkgs[i]);
+    }
+
+    if (job.records) {
+        for (size_t i = 0; i < count; ++i) {
+            /* Files we never had to look at keep whatever we
+               remembered about them last time */
+            if (!job.records[i].len) {
+                const struct scan_record *record = scancache_find(scancache, filenames[i], NULL);
+                if (record)
+                    buffer_append(&job.records[i], record->raw, record->raw_len);
+            }
+
+            if (job.records[i].len)
+                scancache_append(scancache, job.records[i].data, job.records[i].len);
+            buffer_release(&job.records[i]);
+        }
+        free(job.records);
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        pkg_filename_free(&job.names[i]);
+    free(job.names);
+    free(job.members);
+    free(job.groups);
+    free(job.pkgs);
     return cache;
 }
 
-struct pkgcache *get_filecache(int dirfd, alpm_list_t *targets, const char *arch)
+static int filename_cmp(const void *p1, const void *p2)
+{
+    return strcmp(*(char * const *)p1, *(char * const *)p2);
+}
+
+/* If listing is given, the directory listing is handed back to the
+ * caller sorted by name rather than thrown away. */
+struct pkgcache *get_filecache(int dirfd, struct scancache *scancache,
+                               alpm_list_t *targets, const char *arch,
+                               struct pool_listing *listing)
 {
     int dupfd = dup(dirfd);
     check_posix(dupfd, "failed to duplicate fd");
@@ -108,8 +423,27 @@ struct pkgcache *get_filecache(int dirfd, alpm_list_t *targets, const char *arch
     _cleanup_closedir_ DIR *dirp = fdopendir(dupfd);
     check_null(dirp, "fdopendir failed");
 
-    size_t size = get_filecache_size(dirp);
-    struct pkgcache *cache = pkgcache_create(size);
+    size_t count, nfiles;
+    char **filenames = read_pool(dirp, &count, &nfiles);
+    struct pkgcache *cache = pkgcache_create(nfiles);
+
+    cache = scan_for_targets(cache, dirfd, filenames, nfiles, scancache,
+                             targets, arch);
 
-    return scan_for_targets(cache, dirfd, dirp, targets, arch);
+    if (listing) {
+        qsort(filenames, count, sizeof(char *), filename_cmp);
+        *listing = (struct pool_listing){ filenames, count };
+    } else {
+        pool_listing_free(&(struct pool_listing){ filenames, count });
+    }
+
+    return cache;
+}
+
+void pool_listing_free(struct pool_listing *listing)
+{
+    for (size_t i = 0; i < listing->count; ++i)
+        free(listing->filenames[i]);
+    free(listing->filenames);
+    *listing = (struct pool_listing){0};
 }
@@ -3,4 +3,16 @@
 #include <alpm_list.h>
 #include "pkgcache.h"
 
-struct pkgcache *get_filecache(int dirfd, alpm_list_t *targets, const char *arch);
+struct scancache;
+
+/* Every regular file in the pool, along with any symlinks which
+ * resolve, sorted by name */
+struct pool_listing {
+    char **filenames;
+    size_t count;
+};
+
+struct pkgcache *get_filecache(int dirfd, struct scancache *scancache,
+                               alpm_list_t *targets, const char *arch,
+                               struct pool_listing *listing);
+void pool_listing_free(struct pool_listing *listing);
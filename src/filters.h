@@ -12,5 +12,8 @@ static inline bool match_arch(struct pkg *pkg, const char *arch)
 {
     if (!pkg->arch)
         return arch != NULL;
+    /* Both sides are usually interned */
+    if (pkg->arch == arch)
+        return true;
     return streq(pkg->arch, arch) || streq(pkg->arch, "any");
 }
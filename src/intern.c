@@ -0,0 +1,110 @@
+#include "intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "arena.h"
+#include "pkgcache.h"
+#include "util.h"
+
+struct intern_entry {
+    hash_t hash;
+    size_t len;
+    char *str;
+};
+
+static struct {
+    struct intern_entry *table;
+    size_t buckets;
+    size_t count;
+    size_t saved;
+    struct arena arena;
+    pthread_mutex_t lock;
+} interned = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static void insert_entry(struct intern_entry *table, size_t buckets,
+                         const struct intern_entry *entry)
+{
+    size_t position = entry->hash & (buckets - 1);
+    while (table[position].str)
+        position = (position + 1) & (buckets - 1);
+    table[position] = *entry;
+}
+
+/* Keep the table at most half full */
+static void grow_table(void)
+{
+    size_t buckets = interned.buckets ? interned.buckets * 2 : 1024;
+    struct intern_entry *table = calloc(buckets, sizeof(struct intern_entry));
+    check_null(table, "failed to allocate intern table");
+
+    if (!interned.buckets)
+        arena_init(&interned.arena);
+
+    for (size_t i = 0; i < interned.buckets; ++i) {
+        if (interned.table[i].str)
+            insert_entry(table, buckets, &interned.table[i]);
+    }
+
+    free(interned.table);
+    interned.table = table;
+    interned.buckets = buckets;
+}
+
+char *intern(const char *str, size_t len)
+{
+    const char *end = memchr(str, 0, len);
+    if (end)
+        len = end - str;
+
+    const hash_t hash = strnhash(str, len);
+    char *result;
+
+    pthread_mutex_lock(&interned.lock);
+
+    if (interned.count >= interned.buckets / 2)
+        grow_table();
+
+    size_t position = hash & (interned.buckets - 1);
+    for (;; position = (position + 1) & (interned.buckets - 1)) {
+        struct intern_entry *entry = &interned.table[position];
+        if (!entry->str)
+            break;
+
+        if (entry->hash == hash && entry->len == len && memcmp(entry->str, str, len) == 0) {
+            interned.saved += len + 1;
+            result = entry->str;
+            goto done;
+        }
+    }
+
+    result = arena_strndup(&interned.arena, str, len);
+    check_null(result, "failed to intern string");
+
+    interned.table[position] = (struct intern_entry){ hash, len, result };
+    interned.count++;
+
+done:
+    pthread_mutex_unlock(&interned.lock);
+    return result;
+}
+
+size_t intern_count(void)
+{
+    pthread_mutex_lock(&interned.lock);
+    size_t count = interned.count;
+    pthread_mutex_unlock(&interned.lock);
+    return count;
+}
+
+/* Bytes that would have gone to separate copies of interned values */
+size_t intern_saved(void)
+{
+    pthread_mutex_lock(&interned.lock);
+    size_t saved = interned.saved;
+    pthread_mutex_unlock(&interned.lock);
+    return saved;
+}
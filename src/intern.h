@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stddef.h>
+
+/* A process-wide table of immutable strings. Interning the same value
+ * twice returns the same pointer, so interned values can be compared
+ * by address and must never be freed. */
+char *intern(const char *str, size_t len);
+
+size_t intern_count(void);
+size_t intern_saved(void);
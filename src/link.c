@@ -0,0 +1,293 @@
+#include "link.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+
+#include "parallel.h"
+#include "util.h"
+
+static const char *link_names[] = {
+    [LINK_SYMLINK]  = "symlink",
+    [LINK_AUTO]     = "auto",
+    [LINK_REFLINK]  = "reflink",
+    [LINK_COPY]     = "copy",
+    [LINK_HARDLINK] = "hardlink",
+};
+
+int parse_link_mode(const char *str)
+{
+    for (size_t i = 0; i < sizeof(link_names) / sizeof(link_names[0]); ++i) {
+        if (streq(str, link_names[i]))
+            return i;
+    }
+    return -1;
+}
+
+/* Let the kernel copy the file, which lets filesystems and network
+ * mounts share extents or copy server side. Older kernels refuse to
+ * copy across filesystems, and some filesystems quietly copy nothing,
+ * in which case fall back to sendfile. Running out of data before
+ * st_size bytes are copied is an error, never a short file. */
+static int copy_fd(int src, int dest)
+{
+    struct stat st;
+    if (fstat(src, &st) < 0)
+        return -1;
+
+    bool fallback = false;
+    off_t left = st.st_size;
+
+    while (left > 0) {
+        ssize_t nbytes = fallback ? sendfile(dest, src, NULL, left)
+                                  : copy_file_range(src, NULL, dest, NULL, left, 0);
+        if (nbytes < 0) {
+            if (fallback || (errno != EXDEV && errno != ENOSYS &&
+                             errno != EOPNOTSUPP && errno != EINVAL))
+                return -1;
+            fallback = true;
+            continue;
+        } else if (nbytes == 0) {
+            if (fallback) {
+                errno = EIO;
+                return -1;
+            }
+            fallback = true;
+            continue;
+        }
+        left -= nbytes;
+    }
+
+    return 0;
+}
+
+/* Move a freshly made file from tmpname over filename. Whatever was
+ * there before, including a link back into the pool, is replaced in
+ * one step and never written through. */
+static int commit_file(const struct repo *repo, const char *tmpname,
+                       const char *filename, int ret)
+{
+    if (ret == 0)
+        ret = renameat(repo->rootfd, tmpname, repo->rootfd, filename);
+    if (ret < 0) {
+        int saved_errno = errno;
+        unlinkat(repo->rootfd, tmpname, 0);
+        errno = saved_errno;
+    }
+    return ret;
+}
+
+static int clone_file(const struct repo *repo, const char *filename, bool reflink)
+{
+    _cleanup_close_ int src = openat(repo->poolfd, filename, O_RDONLY);
+    if (src < 0)
+        return -1;
+
+    _cleanup_free_ char *tmpname = joinstring(".", filename, ".tmp", NULL);
+    _cleanup_close_ int dest = openat(repo->rootfd, tmpname,
+                                      O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0664);
+    if (dest < 0)
+        return -1;
+
+    int ret = reflink ? ioctl(dest, FICLONE, src) : copy_fd(src, dest);
+    return commit_file(repo, tmpname, filename, ret);
+}
+
+static int hardlink_file(const struct repo *repo, const char *filename)
+{
+    struct stat src, dest;
+    if (fstatat(repo->poolfd, filename, &src, 0) < 0)
+        return -1;
+    if (fstatat(repo->rootfd, filename, &dest, AT_SYMLINK_NOFOLLOW) == 0 &&
+        src.st_dev == dest.st_dev && src.st_ino == dest.st_ino)
+        return 0;
+
+    _cleanup_free_ char *tmpname = joinstring(".", filename, ".tmp", NULL);
+    unlinkat(repo->rootfd, tmpname, 0);
+
+    int ret = linkat(repo->poolfd, filename, repo->rootfd, tmpname, 0);
+    if (ret < 0)
+        return ret;
+    return commit_file(repo, tmpname, filename, ret);
+}
+
+static int symlink_file(const struct repo *repo, const char *filename)
+{
+    _cleanup_free_ char *target = joinstring(repo->poolpath, "/", filename, NULL);
+    int ret = symlinkat(target, repo->rootfd, filename);
+    if (ret < 0 && errno == EEXIST)
+        return 0;
+    return ret;
+}
+
+static int link_file(const struct repo *repo, enum link_mode mode, const char *filename)
+{
+    switch (mode) {
+    case LINK_REFLINK:
+        return clone_file(repo, filename, true);
+    case LINK_COPY:
+        return clone_file(repo, filename, false);
+    case LINK_HARDLINK:
+        return hardlink_file(repo, filename);
+    default:
+        return symlink_file(repo, filename);
+    }
+}
+
+static void link_pkg(const struct repo *repo, enum link_mode mode, const struct pkg *pkg)
+{
+    _cleanup_free_ char *signame = joinstring(pkg->filename, ".sig", NULL);
+
+    if (faccessat(repo->poolfd, signame, F_OK, 0) == 0) {
+        check_posix(link_file(repo, mode, signame),
+                    "failed to make %s for %s", link_names[mode], signame);
+    }
+
+    check_posix(link_file(repo, mode, pkg->filename),
+                "failed to make %s for %s", link_names[mode], pkg->filename);
+}
+
+#define PROBE_NAME ".repose-link-probe"
+
+static bool probe_reflink(const struct repo *repo, int src)
+{
+    _cleanup_close_ int dest = openat(repo->rootfd, PROBE_NAME,
+                                      O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0664);
+    check_posix(dest, "failed to create %s", PROBE_NAME);
+
+    int ret = ioctl(dest, FICLONE, src);
+    int saved_errno = errno;
+    unlinkat(repo->rootfd, PROBE_NAME, 0);
+
+    if (ret < 0 && saved_errno != EXDEV && saved_errno != EOPNOTSUPP &&
+        saved_errno != ENOTTY && saved_errno != EINVAL) {
+        errno = saved_errno;
+        err(EXIT_FAILURE, "failed to probe for reflink support");
+    }
+    return ret == 0;
+}
+
+static bool probe_hardlink(const struct repo *repo, const char *filename)
+{
+    unlinkat(repo->rootfd, PROBE_NAME, 0);
+
+    int ret = linkat(repo->poolfd, filename, repo->rootfd, PROBE_NAME, 0);
+    int saved_errno = errno;
+    unlinkat(repo->rootfd, PROBE_NAME, 0);
+
+    if (ret < 0 && saved_errno != EXDEV && saved_errno != EPERM) {
+        errno = saved_errno;
+        err(EXIT_FAILURE, "failed to probe for hardlink support");
+    }
+    return ret == 0;
+}
+
+/* Any regular file in the pool will do to probe with */
+static char *find_probe_source(const struct repo *repo)
+{
+    int fd = openat(repo->poolfd, ".", O_RDONLY | O_DIRECTORY);
+    check_posix(fd, "failed to open pool directory %s", repo->pool);
+
+    _cleanup_closedir_ DIR *dirp = fdopendir(fd);
+    check_null(dirp, "failed to open pool directory %s", repo->pool);
+
+    struct dirent *dp;
+    while ((dp = readdir(dirp))) {
+        struct stat st;
+        if (fstatat(repo->poolfd, dp->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+            S_ISREG(st.st_mode) && st.st_size > 0)
+            return strdup(dp->d_name);
+    }
+    return NULL;
+}
+
+/* Settle --link=auto before anything is linked or unlinked, since
+ * unlinking depends on the mode too. Try the cheapest independent copy
+ * first, then a hardlink, which only works inside one filesystem, then
+ * settle for a symlink. The probes work on a scratch name in the root,
+ * so no package is touched. Only the expected "not supported here"
+ * errors move on to the next mode; anything else is a real problem
+ * with the root and fails the run. */
+void resolve_link_mode(struct repo *repo)
+{
+    repo->link = config.link;
+    if (repo->link != LINK_AUTO)
+        return;
+
+    repo->link = LINK_SYMLINK;
+    if (!repo->pool)
+        return;
+
+    /* With nothing in the pool there's nothing to link, and regular
+     * files in the root are left alone */
+    _cleanup_free_ char *filename = find_probe_source(repo);
+    if (!filename)
+        return;
+
+    _cleanup_close_ int src = openat(repo->poolfd, filename, O_RDONLY);
+    check_posix(src, "failed to open %s", filename);
+
+    if (probe_reflink(repo, src))
+        repo->link = LINK_REFLINK;
+    else if (probe_hardlink(repo, filename))
+        repo->link = LINK_HARDLINK;
+
+    trace("linking packages with %s\n", link_names[repo->link]);
+}
+
+struct link_job {
+    const struct repo *repo;
+    struct pkg **pkgs;
+};
+
+static void link_one(void *data, size_t idx)
+{
+    const struct link_job *job = data;
+    link_pkg(job->repo, job->repo->link, job->pkgs[idx]);
+}
+
+/* Every package is linked independently, so the work is spread over
+ * the job pool; each file only costs a handful of metadata calls. */
+void link_pkgs(const struct repo *repo, struct pkg **pkgs, size_t count)
+{
+    struct link_job job = {
+        .repo = repo,
+        .pkgs = pkgs,
+    };
+
+    parallel_for(config.jobs, count, link_one, &job);
+}
+
+/* Symlinks in the root are always ours. Regular files are only ours
+ * to remove when packages are being copied or hardlinked out of a
+ * separate pool; otherwise they're the packages themselves. */
+static int unlink_file(const struct repo *repo, const char *filename)
+{
+    struct stat st;
+    if (fstatat(repo->rootfd, filename, &st, AT_SYMLINK_NOFOLLOW) < 0)
+        return errno != ENOENT ? -1 : 0;
+
+    if (S_ISLNK(st.st_mode) ||
+        (S_ISREG(st.st_mode) && repo->pool && repo->link != LINK_SYMLINK))
+        return unlinkat(repo->rootfd, filename, 0);
+    return 0;
+}
+
+int unlink_pkg(const struct repo *repo, const struct pkg *pkg)
+{
+    int ret = unlink_file(repo, pkg->filename);
+    if (ret < 0)
+        return ret;
+
+    _cleanup_free_ char *signame = joinstring(pkg->filename, ".sig", NULL);
+    return unlink_file(repo, signame);
+}
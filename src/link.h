@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stddef.h>
+#include "repose.h"
+#include "package.h"
+
+int parse_link_mode(const char *str);
+
+void resolve_link_mode(struct repo *repo);
+void link_pkgs(const struct repo *repo, struct pkg **pkgs, size_t count);
+int unlink_pkg(const struct repo *repo, const struct pkg *pkg);
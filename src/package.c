@@ -3,59 +3,403 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
 #include <err.h>
 #include <archive.h>
 #include <archive_entry.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <openssl/evp.h>
 
 #include "util.h"
+#include "arena.h"
+#include "intern.h"
 #include "pkginfo.h"
 #include "pkgcache.h"
 #include "base64.h"
+#include "buffer.h"
 
-int load_package(pkg_t *pkg, int fd)
+int parse_package_filename(const char *filename, struct pkg_filename *info)
 {
-    struct archive *archive;
-    struct stat st;
+    static const char pkgext[] = ".pkg.tar";
+    const char *ext = NULL, *p;
+
+    *info = (struct pkg_filename){0};
+
+    for (p = strstr(filename, pkgext); p; p = strstr(p + 1, pkgext))
+        ext = p;
+    if (!ext || ext == filename)
+        return -EINVAL;
+
+    /* Only accept a single compression suffix, so things like
+     * foo.pkg.tar.xz.sig or foo.pkg.tar.zst.part are rejected */
+    p = ext + strlen(pkgext);
+    if (*p) {
+        if (*p++ != '.' || !*p)
+            return -EINVAL;
+        for (; *p; ++p) {
+            if (!isalnum((unsigned char)*p))
+                return -EINVAL;
+        }
+    }
 
-    check_posix(fstat(fd, &st), "failed to stat file");
+    char *name = strndup(filename, ext - filename);
+    char *arch = strrchr(name, '-');
+    if (!arch || !arch[1])
+        goto invalid;
+    *arch++ = '\0';
+
+    char *rel = strrchr(name, '-');
+    if (!rel || !rel[1])
+        goto invalid;
+
+    char *ver = memrchr(name, '-', rel - name);
+    if (!ver || ver == name || ver + 1 == rel)
+        goto invalid;
+    *ver++ = '\0';
+
+    info->name = name;
+    info->version = ver;
+    info->arch = arch;
+    return 0;
+
+invalid:
+    free(name);
+    return -EINVAL;
+}
+
+void pkg_filename_free(struct pkg_filename *info)
+{
+    free(info->name);
+    free(info->vkey);
+    *info = (struct pkg_filename){0};
+}
+
+/* Packages which aren't mapped are read in large blocks instead */
+#define PACKAGE_BLOCK_SIZE 0x20000
+
+struct package_reader {
+    int fd;
+    EVP_MD_CTX *sha256;
+    unsigned char *map;
+    size_t size;
+    char *buf;
+};
+
+static const struct {
+    const char *magic;
+    size_t len;
+    int (*support)(struct archive *);
+} compression_magic[] = {
+    { "\x1f\x8b",             2, archive_read_support_filter_gzip },
+    { "\xfd" "7zXZ\x00",       6, archive_read_support_filter_xz },
+    { "\x28\xb5\x2f\xfd",     4, archive_read_support_filter_zstd },
+    { "BZh",                  3, archive_read_support_filter_bzip2 },
+    { "\x04\x22\x4d\x18",     4, archive_read_support_filter_lz4 },
+    { "\x1f\x9d",             2, archive_read_support_filter_compress },
+};
+
+/* Sniff the compression from the magic bytes so we only have to
+ * register a single filter and the tar format, rather than have
+ * libarchive bid on every format it knows. */
+static void support_package_format(struct archive *archive,
+                                   const unsigned char *magic, size_t len)
+{
+    for (size_t i = 0; i < sizeof(compression_magic) / sizeof(*compression_magic); ++i) {
+        if (len >= compression_magic[i].len &&
+            memcmp(magic, compression_magic[i].magic, compression_magic[i].len) == 0) {
+            compression_magic[i].support(archive);
+            archive_read_support_format_tar(archive);
+            return;
+        }
+    }
+
+    if (len >= 262 && memcmp(magic + 257, "ustar", 5) == 0) {
+        archive_read_support_format_tar(archive);
+        return;
+    }
 
-    archive = archive_read_new();
     archive_read_support_filter_all(archive);
     archive_read_support_format_all(archive);
+}
+
+static ssize_t package_read_cb(struct archive *archive, void *data, const void **buf)
+{
+    struct package_reader *reader = data;
+
+    ssize_t nbytes_r = read(reader->fd, reader->buf, PACKAGE_BLOCK_SIZE);
+    if (nbytes_r < 0) {
+        archive_set_error(archive, errno, "failed to read package");
+        return -1;
+    }
+
+    if (reader->sha256)
+        EVP_DigestUpdate(reader->sha256, reader->buf, nbytes_r);
+
+    *buf = reader->buf;
+    return nbytes_r;
+}
+
+/* Hash whatever libarchive didn't need to look at */
+static int package_read_rest(struct package_reader *reader)
+{
+    if (reader->map) {
+        EVP_DigestUpdate(reader->sha256, reader->map, reader->size);
+        return 0;
+    }
+
+    for (;;) {
+        ssize_t nbytes_r = read(reader->fd, reader->buf, PACKAGE_BLOCK_SIZE);
+        if (nbytes_r < 0)
+            return -1;
+        if (nbytes_r == 0)
+            return 0;
+        EVP_DigestUpdate(reader->sha256, reader->buf, nbytes_r);
+    }
+}
 
-    if (archive_read_open_fd(archive, fd, 8192) != ARCHIVE_OK) {
+static struct archive *open_package(struct package_reader *reader, int flags)
+{
+    struct stat st;
+    check_posix(fstat(reader->fd, &st), "failed to stat file");
+
+    /* Only map packages which are going to be walked end to end. Just
+     * getting at .PKGINFO is cheaper through read(): handed the whole
+     * mapping at once, libarchive's zstd filter spends several times
+     * longer getting to the first entry (see bench/package.c). */
+    if (st.st_size > 0 && flags & (LOAD_FILES | LOAD_SHA256)) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+        if (map != MAP_FAILED) {
+            reader->map = map;
+            reader->size = st.st_size;
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+        }
+    }
+
+    unsigned char magic[262];
+    ssize_t magic_len;
+    if (reader->map) {
+        magic_len = reader->size < sizeof(magic) ? reader->size : sizeof(magic);
+        memcpy(magic, reader->map, magic_len);
+    } else {
+        magic_len = pread(reader->fd, magic, sizeof(magic), 0);
+        if (magic_len < 0)
+            return NULL;
+
+        reader->buf = malloc(PACKAGE_BLOCK_SIZE);
+        check_null(reader->buf, "failed to allocate read buffer");
+    }
+
+    struct archive *archive = archive_read_new();
+    support_package_format(archive, magic, magic_len);
+
+    int ret;
+    if (reader->map) {
+        ret = archive_read_open_memory(archive, reader->map, reader->size);
+    } else {
+        ret = archive_read_open(archive, reader, NULL, package_read_cb, NULL);
+    }
+
+    if (ret != ARCHIVE_OK) {
         archive_read_free(archive);
+        return NULL;
+    }
+
+    return archive;
+}
+
+static void release_package_reader(struct package_reader *reader)
+{
+    if (reader->map)
+        munmap(reader->map, reader->size);
+    free(reader->buf);
+    EVP_MD_CTX_free(reader->sha256);
+}
+
+/* A package without an arena owns everything it points at, except
+ * interned values. An arena package only owns the fields marked in
+ * owned, like a checksum computed after it was loaded. */
+static bool owns_value(const struct pkg *pkg, enum pkg_entry field)
+{
+    return !pkg->arena || pkg->owned & PKG_FIELD(field);
+}
+
+static void release_string(struct pkg *pkg, enum pkg_entry field, char *str)
+{
+    if (owns_value(pkg, field))
+        free(str);
+}
+
+static void release_list(struct pkg *pkg, enum pkg_entry field, alpm_list_t *list)
+{
+    if (!owns_value(pkg, field))
+        return;
+
+    alpm_list_free_inner(list, free);
+    alpm_list_free(list);
+}
+
+/* Only the nodes belong to the package, the values are interned */
+static void release_interned_list(struct pkg *pkg, enum pkg_entry field, alpm_list_t *list)
+{
+    if (owns_value(pkg, field))
+        alpm_list_free(list);
+}
+
+static int read_mtree_entries(struct archive *mtree, alpm_list_t **files)
+{
+    struct archive_entry *entry;
+    int ret;
+
+    while ((ret = archive_read_next_header(mtree, &entry)) == ARCHIVE_OK) {
+        const char *path = archive_entry_pathname(entry);
+
+        /* strip leading "./" from path entries, and skip the package
+         * metadata, just like we would when walking the tarball */
+        if (path[0] == '.' && path[1] == '/')
+            path += 2;
+        if (path[0] == '.' || path[0] == '\0')
+            continue;
+
+        const size_t len = strlen(path);
+        if (archive_entry_filetype(entry) == AE_IFDIR && path[len - 1] != '/') {
+            *files = alpm_list_add(*files, joinstring(path, "/", NULL));
+        } else {
+            *files = alpm_list_add(*files, strdup(path));
+        }
+    }
+
+    return ret == ARCHIVE_EOF ? 0 : -1;
+}
+
+/* makepkg ships a small gzip'd mtree of the whole package up front.
+ * Building the file list from it saves decompressing the payload. */
+static int read_mtree(struct archive *archive, struct pkg *pkg)
+{
+    struct buffer buf = {0};
+
+    for (;;) {
+        char *block;
+        size_t block_len;
+
+        int status = archive_read(archive, &block, &block_len);
+        if (status == ARCHIVE_EOF)
+            break;
+        if (status < ARCHIVE_OK) {
+            buffer_release(&buf);
+            return -1;
+        }
+        buffer_append(&buf, block, block_len);
+    }
+
+    struct archive *mtree = archive_read_new();
+    archive_read_support_filter_gzip(mtree);
+    archive_read_support_format_mtree(mtree);
+
+    alpm_list_t *files = NULL;
+    int ret = -1;
+
+    if (archive_read_open_memory(mtree, buf.data, buf.len) == ARCHIVE_OK)
+        ret = read_mtree_entries(mtree, &files);
+
+    archive_read_close(mtree);
+    archive_read_free(mtree);
+    buffer_release(&buf);
+
+    if (ret < 0) {
+        alpm_list_free_inner(files, free);
+        alpm_list_free(files);
         return -1;
     }
 
-    bool found_pkginfo = false;
+    release_list(pkg, PKG_FILES, pkg->files);
+    pkg->files = files;
+    pkg->owned |= PKG_FIELD(PKG_FILES);
+    return 0;
+}
+
+/* Read everything asked for out of a package in a single pass over
+ * the file. The raw bytes are fed to SHA256 as libarchive pulls them
+ * in, so hashing doesn't require reading the package a second time. */
+static int read_package(struct pkg *pkg, int fd, int flags)
+{
+    struct package_reader reader = { .fd = fd };
+    if (flags & LOAD_SHA256) {
+        reader.sha256 = EVP_MD_CTX_new();
+        check_null(reader.sha256, "failed to allocate digest context");
+        EVP_DigestInit_ex(reader.sha256, EVP_sha256(), NULL);
+    }
+
+    struct archive *archive = open_package(&reader, flags);
+    if (!archive) {
+        release_package_reader(&reader);
+        return -1;
+    }
+
+    bool found_pkginfo = false, found_mtree = false;
     struct archive_entry *entry;
-    while (archive_read_next_header(archive, &entry) == ARCHIVE_OK && !found_pkginfo) {
+    for (;;) {
+        if ((found_pkginfo || !(flags & LOAD_PKGINFO)) &&
+            (found_mtree || !(flags & LOAD_FILES)))
+            break;
+        if (archive_read_next_header(archive, &entry) != ARCHIVE_OK)
+            break;
+
         const char *entry_name = archive_entry_pathname(entry);
         const mode_t mode = archive_entry_mode(entry);
 
-        if (S_ISREG(mode) && streq(entry_name, ".PKGINFO")) {
+        if (flags & LOAD_PKGINFO && S_ISREG(mode) && streq(entry_name, ".PKGINFO")) {
             if (read_pkginfo(archive, pkg) < 0) {
                 errx(EXIT_FAILURE, "failed to parse PKGINFO on %s", pkg->filename);
             }
             found_pkginfo = true;
+        } else if (flags & LOAD_FILES && S_ISREG(mode) && streq(entry_name, ".MTREE")) {
+            /* If the mtree is unreadable, fall back to collecting the
+             * file list from the tarball itself */
+            found_mtree = read_mtree(archive, pkg) == 0;
+        } else if (flags & LOAD_FILES && !found_mtree && entry_name[0] != '.') {
+            pkg->files = alpm_list_add(pkg->files, strdup(entry_name));
+            pkg->owned |= PKG_FIELD(PKG_FILES);
         }
     }
 
     archive_read_close(archive);
     archive_read_free(archive);
 
-    if (found_pkginfo) {
-        pkg->hash = sdbm(pkg->name);
-        pkg->size = st.st_size;
-        pkg->mtime = st.st_mtime;
-        return 0;
+    int ret = 0;
+    if (flags & LOAD_PKGINFO && !found_pkginfo) {
+        ret = -1;
+    } else if (reader.sha256) {
+        unsigned char output[EVP_MAX_MD_SIZE];
+        unsigned int len;
+
+        check_posix(package_read_rest(&reader), "failed to read %s", pkg->filename);
+        EVP_DigestFinal_ex(reader.sha256, output, &len);
+        pkg->sha256sum = hex_representation(output, len);
+        pkg->owned |= PKG_FIELD(PKG_SHA256SUM);
     }
 
-    return -1;
+    release_package_reader(&reader);
+    return ret;
+}
+
+int load_package(pkg_t *pkg, int fd, int flags)
+{
+    struct stat st;
+
+    check_posix(fstat(fd, &st), "failed to stat file");
+
+    if (read_package(pkg, fd, LOAD_PKGINFO | flags) < 0)
+        return -1;
+
+    pkg->hash = strhash(pkg->name);
+    pkg->size = st.st_size;
+    if (st.st_mtime > pkg->mtime)
+        pkg->mtime = st.st_mtime;
+    return 0;
 }
 
 int load_package_signature(struct pkg *pkg, int dirfd)
@@ -74,6 +418,7 @@ int load_package_signature(struct pkg *pkg, int dirfd)
     pkg->base64sig = base64_encode((const unsigned char *)signature,
                                    st.st_size, NULL);
     check_null(pkg->base64sig, "failed to find base64 signature");
+    pkg->owned |= PKG_FIELD(PKG_PGPSIG);
 
     // If the signature's timestamp is new than the packages, update
     // it to the newer value.
@@ -85,174 +430,236 @@ int load_package_signature(struct pkg *pkg, int dirfd)
 
 int load_package_files(struct pkg *pkg, int fd)
 {
-    struct archive *archive;
-    struct stat st;
+    return read_package(pkg, fd, LOAD_FILES);
+}
 
-    check_posix(fstat(fd, &st), "failed to stat file");
+/* Fill in the checksum and/or file list of a package which was
+ * already loaded, in a single pass over the file */
+int load_package_contents(struct pkg *pkg, int fd, int flags)
+{
+    return read_package(pkg, fd, flags & (LOAD_FILES | LOAD_SHA256));
+}
 
-    archive = archive_read_new();
-    archive_read_support_filter_all(archive);
-    archive_read_support_format_all(archive);
+void package_free(pkg_t *pkg)
+{
+    release_string(pkg, PKG_FILENAME, pkg->filename);
+    release_string(pkg, PKG_PKGNAME, pkg->name);
+    release_string(pkg, PKG_PKGBASE, pkg->base);
+    release_string(pkg, PKG_VERSION, pkg->version);
+    release_string(pkg, PKG_DESCRIPTION, pkg->desc);
+    release_string(pkg, PKG_URL, pkg->url);
+    release_string(pkg, PKG_SHA256SUM, pkg->sha256sum);
+    release_string(pkg, PKG_PGPSIG, pkg->base64sig);
+
+    release_interned_list(pkg, PKG_GROUPS, pkg->groups);
+    release_interned_list(pkg, PKG_LICENSE, pkg->licenses);
+    release_interned_list(pkg, PKG_REPLACES, pkg->replaces);
+    release_interned_list(pkg, PKG_DEPENDS, pkg->depends);
+    release_interned_list(pkg, PKG_CONFLICTS, pkg->conflicts);
+    release_interned_list(pkg, PKG_PROVIDES, pkg->provides);
+    release_interned_list(pkg, PKG_OPTDEPENDS, pkg->optdepends);
+    release_interned_list(pkg, PKG_MAKEDEPENDS, pkg->makedepends);
+    release_interned_list(pkg, PKG_CHECKDEPENDS, pkg->checkdepends);
+    release_list(pkg, PKG_FILES, pkg->files);
+    release_list(pkg, PKG_DELTAS, pkg->deltas);
+
+    raw_entry_release(&pkg->raw_desc);
+    raw_entry_release(&pkg->raw_depends);
+    raw_entry_release(&pkg->raw_files);
+    free(pkg->vkey);
+
+    if (!pkg->arena)
+        free(pkg);
+}
 
-    if (archive_read_open_fd(archive, fd, 8192) != ARCHIVE_OK) {
-        archive_read_free(archive);
-        return -1;
-    }
+/* Raw entries may point into a mapped repository snapshot, which
+ * outlives the package */
+void raw_entry_release(struct raw_entry *raw)
+{
+    if (!raw->mapped)
+        free(raw->data);
+    *raw = (struct raw_entry){0};
+}
 
-    struct archive_entry *entry;
-    while (archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
-        const char *entry_name = archive_entry_pathname(entry);
+/* Same as alpm_list_add, but with the node in the arena */
+static void arena_list_add(struct arena *arena, alpm_list_t **list, void *data)
+{
+    alpm_list_t *node = arena_alloc(arena, sizeof(alpm_list_t));
+    if (!node)
+        return;
+
+    *node = (alpm_list_t){ .data = data, .prev = node };
+    if (*list) {
+        alpm_list_t *tail = (*list)->prev;
+        tail->next = node;
+        node->prev = tail;
+        (*list)->prev = node;
+    } else {
+        *list = node;
+    }
+}
 
-        if (entry_name[0] != '.')
-            pkg->files = alpm_list_add(pkg->files, strdup(entry_name));
+static void pkg_append_list(struct pkg *pkg, enum pkg_entry type, const char *entry,
+                            size_t len, alpm_list_t **list)
+{
+    if (owns_value(pkg, type)) {
+        *list = alpm_list_add(*list, strndup(entry, len));
+    } else {
+        arena_list_add(pkg->arena, list, arena_strndup(pkg->arena, entry, len));
     }
+}
 
-    archive_read_close(archive);
-    archive_read_free(archive);
-    return 0;
+static void pkg_set_string(struct pkg *pkg, enum pkg_entry type, const char *entry,
+                           size_t len, char **data)
+{
+    release_string(pkg, type, *data);
+    pkg->owned &= ~PKG_FIELD(type);
+    *data = pkg->arena ? arena_strndup(pkg->arena, entry, len) : strndup(entry, len);
 }
 
-void package_free(pkg_t *pkg)
+static void pkg_intern_list(struct pkg *pkg, enum pkg_entry type, const char *entry,
+                            size_t len, alpm_list_t **list)
+{
+    if (owns_value(pkg, type)) {
+        *list = alpm_list_add(*list, intern(entry, len));
+    } else {
+        arena_list_add(pkg->arena, list, intern(entry, len));
+    }
+}
+
+/* Interned values are shared and never freed */
+static void pkg_intern_string(_unused_ struct pkg *pkg, _unused_ enum pkg_entry type,
+                              const char *entry, size_t len, char **data)
 {
-    free(pkg->filename);
-    free(pkg->name);
-    free(pkg->version);
-    free(pkg->desc);
-    free(pkg->url);
-    free(pkg->packager);
-    free(pkg->sha256sum);
-    free(pkg->base64sig);
-    free(pkg->arch);
-
-    alpm_list_free_inner(pkg->groups, free);
-    alpm_list_free(pkg->groups);
-    alpm_list_free_inner(pkg->licenses, free);
-    alpm_list_free(pkg->licenses);
-    alpm_list_free_inner(pkg->depends, free);
-    alpm_list_free(pkg->depends);
-    alpm_list_free_inner(pkg->conflicts, free);
-    alpm_list_free(pkg->conflicts);
-    alpm_list_free_inner(pkg->provides, free);
-    alpm_list_free(pkg->provides);
-    alpm_list_free_inner(pkg->optdepends, free);
-    alpm_list_free(pkg->optdepends);
-    alpm_list_free_inner(pkg->makedepends, free);
-    alpm_list_free(pkg->makedepends);
-    alpm_list_free_inner(pkg->files, free);
-    alpm_list_free(pkg->files);
-
-    free(pkg);
+    *data = intern(entry, len);
 }
 
-static void pkg_append_list(const char *entry, size_t len, alpm_list_t **list)
+/* Entries are spans into the parser's input and aren't NUL terminated */
+static bool copy_number(char *buf, size_t buflen, const char *entry, size_t len)
 {
-    *list = alpm_list_add(*list, strndup(entry, len));
+    if (len >= buflen)
+        return false;
+
+    memcpy(buf, entry, len);
+    buf[len] = 0;
+    return true;
 }
 
-static void pkg_set_string(const char *entry, size_t len, char **data)
+static void pkg_set_size(_unused_ struct pkg *pkg, _unused_ enum pkg_entry type,
+                         const char *entry, size_t len, size_t *data)
 {
-    free(*data);
-    *data = strndup(entry, len);
+    char buf[32];
+    if (copy_number(buf, sizeof(buf), entry, len))
+        parse_size(buf, data);
 }
 
-static void pkg_set_size(const char *entry, size_t _unused_ len, size_t *data)
+static void pkg_set_time(_unused_ struct pkg *pkg, _unused_ enum pkg_entry type,
+                         const char *entry, size_t len, time_t *data)
 {
-    parse_size(entry, data);
+    char buf[32];
+    if (copy_number(buf, sizeof(buf), entry, len))
+        parse_time(buf, data);
 }
 
-static void pkg_set_time(const char *entry, size_t _unused_ len, time_t *data)
+static bool span_eq(const char *entry, size_t len, const char *str)
 {
-    parse_time(entry, data);
+    return strlen(str) == len && memcmp(entry, str, len) == 0;
 }
 
-#define pkg_set(entry, len, field) _Generic((field), \
+#define pkg_set(pkg, type, entry, len, field) _Generic((field), \
     alpm_list_t **: pkg_append_list, \
     char **: pkg_set_string, \
     size_t *: pkg_set_size, \
-    time_t *: pkg_set_time)(entry, len, field)
+    time_t *: pkg_set_time)(pkg, type, entry, len, field)
+
+/* For values which repeat across packages: dependencies, licenses,
+ * groups, arch and packager */
+#define pkg_intern(pkg, type, entry, len, field) _Generic((field), \
+    alpm_list_t **: pkg_intern_list, \
+    char **: pkg_intern_string)(pkg, type, entry, len, field)
 
 void package_set(pkg_t *pkg, enum pkg_entry type, const char *entry, size_t len)
 {
     switch (type) {
     case PKG_FILENAME:
-        pkg_set(entry, len, &pkg->filename);
+        pkg_set(pkg, type, entry, len, &pkg->filename);
         break;
     case PKG_PKGNAME:
         if (!pkg->name) {
-            pkg_set(entry, len, &pkg->name);
-        } else if (!strneq(entry, pkg->name, len)) {
+            pkg_set(pkg, type, entry, len, &pkg->name);
+        } else if (!span_eq(entry, len, pkg->name)) {
             errx(EXIT_FAILURE, "database entry %%NAME%% and desc record are mismatched!");
         }
         break;
     case PKG_PKGBASE:
-        pkg_set(entry, len, &pkg->base);
+        pkg_set(pkg, type, entry, len, &pkg->base);
         break;
     case PKG_VERSION:
         if (!pkg->version) {
-            pkg_set(entry, len, &pkg->version);
-        } else if (!strneq(entry, pkg->version, len)) {
+            pkg_set(pkg, type, entry, len, &pkg->version);
+        } else if (!span_eq(entry, len, pkg->version)) {
             errx(EXIT_FAILURE, "database entry %%VERSION%% and desc record are mismatched!");
         }
         break;
     case PKG_DESCRIPTION:
-        pkg_set(entry, len, &pkg->desc);
+        pkg_set(pkg, type, entry, len, &pkg->desc);
         break;
     case PKG_GROUPS:
-        pkg_set(entry, len, &pkg->groups);
+        pkg_intern(pkg, type, entry, len, &pkg->groups);
         break;
     case PKG_CSIZE:
-        pkg_set(entry, len, &pkg->size);
+        pkg_set(pkg, type, entry, len, &pkg->size);
         break;
     case PKG_ISIZE:
-        pkg_set(entry, len, &pkg->isize);
+        pkg_set(pkg, type, entry, len, &pkg->isize);
         break;
     case PKG_SHA256SUM:
-        pkg_set(entry, len, &pkg->sha256sum);
+        pkg_set(pkg, type, entry, len, &pkg->sha256sum);
         break;
     case PKG_PGPSIG:
-        pkg_set(entry, len, &pkg->base64sig);
+        pkg_set(pkg, type, entry, len, &pkg->base64sig);
         break;
     case PKG_URL:
-        pkg_set(entry, len, &pkg->url);
+        pkg_set(pkg, type, entry, len, &pkg->url);
         break;
     case PKG_LICENSE:
-        pkg_set(entry, len, &pkg->licenses);
+        pkg_intern(pkg, type, entry, len, &pkg->licenses);
         break;
     case PKG_ARCH:
-        pkg_set(entry, len, &pkg->arch);
+        pkg_intern(pkg, type, entry, len, &pkg->arch);
         break;
     case PKG_BUILDDATE:
-        pkg_set(entry, len, &pkg->builddate);
+        pkg_set(pkg, type, entry, len, &pkg->builddate);
         break;
     case PKG_PACKAGER:
-        pkg_set(entry, len, &pkg->packager);
+        pkg_intern(pkg, type, entry, len, &pkg->packager);
         break;
     case PKG_REPLACES:
-        pkg_set(entry, len, &pkg->replaces);
+        pkg_intern(pkg, type, entry, len, &pkg->replaces);
         break;
     case PKG_DEPENDS:
-        pkg_set(entry, len, &pkg->depends);
+        pkg_intern(pkg, type, entry, len, &pkg->depends);
         break;
     case PKG_CONFLICTS:
-        pkg_set(entry, len, &pkg->conflicts);
+        pkg_intern(pkg, type, entry, len, &pkg->conflicts);
         break;
     case PKG_PROVIDES:
-        pkg_set(entry, len, &pkg->provides);
+        pkg_intern(pkg, type, entry, len, &pkg->provides);
         break;
     case PKG_OPTDEPENDS:
-        pkg_set(entry, len, &pkg->optdepends);
+        pkg_intern(pkg, type, entry, len, &pkg->optdepends);
         break;
     case PKG_MAKEDEPENDS:
-        pkg_set(entry, len, &pkg->makedepends);
+        pkg_intern(pkg, type, entry, len, &pkg->makedepends);
         break;
     case PKG_CHECKDEPENDS:
-        pkg_set(entry, len, &pkg->checkdepends);
+        pkg_intern(pkg, type, entry, len, &pkg->checkdepends);
         break;
     case PKG_FILES:
-        pkg_set(entry, len, &pkg->files);
+        pkg_set(pkg, type, entry, len, &pkg->files);
         break;
     case PKG_DELTAS:
-        pkg_set(entry, len, &pkg->deltas);
+        pkg_set(pkg, type, entry, len, &pkg->deltas);
         break;
     default:
         break;
@@ -1,12 +1,16 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
 #include <alpm_list.h>
 
 typedef uint64_t hash_t;
 
+struct arena;
+struct version_key;
+
 enum pkg_entry {
     PKG_FILENAME,
     PKG_PKGNAME,
@@ -36,6 +40,17 @@ enum pkg_entry {
     PKG_MAKEPKGOPT
 };
 
+/* A set of pkg_entry fields, used to parse only part of a desc entry */
+#define PKG_FIELD(entry) (UINT64_C(1) << (entry))
+#define PKG_ALL_FIELDS   (~UINT64_C(0))
+
+/* An entry exactly as it was read out of an existing database */
+struct raw_entry {
+    char *data;
+    size_t len;
+    bool mapped;
+};
+
 typedef struct pkg {
     hash_t hash;
     char *filename;
@@ -64,10 +79,47 @@ typedef struct pkg {
     alpm_list_t *checkdepends;
     alpm_list_t *files;
     alpm_list_t *deltas;
+
+    /* Written back out verbatim while the package is unchanged. Fields
+     * in lazy haven't been parsed out of raw_desc yet. */
+    uint64_t lazy;
+    struct raw_entry raw_desc;
+    struct raw_entry raw_depends;
+    struct raw_entry raw_files;
+
+    /* Set when the package and everything package_set() stores in it
+     * live in an arena, rather than in individual allocations. Fields
+     * in owned were allocated on their own anyway and are freed with
+     * the package. */
+    struct arena *arena;
+    uint64_t owned;
+
+    /* The parsed version, built by pkg_vercmp() on first use */
+    struct version_key *vkey;
 } pkg_t;
 
-int load_package(pkg_t *pkg, int fd);
+/* Metadata derived from a name-pkgver-pkgrel-arch.pkg.tar.* filename.
+ * The name, version and arch fields all share the same memory */
+struct pkg_filename {
+    char *name;
+    char *version;
+    char *arch;
+    struct version_key *vkey;
+};
+
+int parse_package_filename(const char *filename, struct pkg_filename *info);
+void pkg_filename_free(struct pkg_filename *info);
+
+enum load_flags {
+    LOAD_PKGINFO = 1,
+    LOAD_FILES   = 1 << 1,
+    LOAD_SHA256  = 1 << 2
+};
+
+int load_package(pkg_t *pkg, int fd, int flags);
 int load_package_signature(struct pkg *pkg, int fd);
 int load_package_files(pkg_t *pkg, int fd);
+int load_package_contents(struct pkg *pkg, int fd, int flags);
 void package_free(pkg_t *pkg);
+void raw_entry_release(struct raw_entry *raw);
 void package_set(pkg_t *pkg, enum pkg_entry type, const char *entry, size_t len);
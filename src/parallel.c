@@ -0,0 +1,234 @@
+#include "parallel.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <err.h>
+#include <pthread.h>
+
+#include "util.h"
+
+struct parallel_ctx {
+    parallel_fn fn;
+    void *data;
+    size_t count;
+    atomic_size_t next;
+};
+
+static void *parallel_worker(void *arg)
+{
+    struct parallel_ctx *ctx = arg;
+
+    for (;;) {
+        size_t idx = atomic_fetch_add(&ctx->next, 1);
+        if (idx >= ctx->count)
+            break;
+        ctx->fn(ctx->data, idx);
+    }
+
+    return NULL;
+}
+
+/* Run fn over every index in [0, count) across up to jobs threads.
+ * The calling thread participates, so jobs <= 1 degrades to a plain
+ * serial loop. Indices are handed out in order but may complete in
+ * any order: fn must only touch state belonging to its own index. */
+void parallel_for(int jobs, size_t count, parallel_fn fn, void *data)
+{
+    struct parallel_ctx ctx = {
+        .fn = fn,
+        .data = data,
+        .count = count,
+    };
+    atomic_init(&ctx.next, 0);
+
+    if (jobs < 1)
+        jobs = 1;
+    if ((size_t)jobs > count)
+        jobs = count;
+
+    if (jobs <= 1) {
+        parallel_worker(&ctx);
+        return;
+    }
+
+    _cleanup_free_ pthread_t *threads = calloc(jobs - 1, sizeof(pthread_t));
+    check_null(threads, "failed to allocate worker threads");
+
+    for (int i = 0; i < jobs - 1; ++i) {
+        int rc = pthread_create(&threads[i], NULL, parallel_worker, &ctx);
+        if (rc != 0) {
+            errno = rc;
+            err(EXIT_FAILURE, "failed to spawn worker thread");
+        }
+    }
+
+    parallel_worker(&ctx);
+
+    for (int i = 0; i < jobs - 1; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+struct pipeline_ctx {
+    pipeline_fn produce;
+    void *data;
+    size_t count;
+    size_t window;
+
+    pthread_mutex_t lock;
+    pthread_cond_t produced;
+    pthread_cond_t consumed;
+    size_t next;
+    size_t done;
+    size_t *filled;
+    size_t *progress;
+    size_t nconsumers;
+};
+
+struct pipeline_reader {
+    struct pipeline_ctx *ctx;
+    const struct pipeline_consumer *consumer;
+    size_t id;
+};
+
+static void *pipeline_worker(void *arg)
+{
+    struct pipeline_ctx *ctx = arg;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (;;) {
+        /* Don't run further ahead of the slowest consumer than the window */
+        while (ctx->next < ctx->count && ctx->next >= ctx->done + ctx->window)
+            pthread_cond_wait(&ctx->consumed, &ctx->lock);
+        if (ctx->next >= ctx->count)
+            break;
+
+        size_t idx = ctx->next++;
+        pthread_mutex_unlock(&ctx->lock);
+
+        ctx->produce(ctx->data, idx, idx % ctx->window);
+
+        pthread_mutex_lock(&ctx->lock);
+        ctx->filled[idx % ctx->window] = idx + 1;
+        pthread_cond_broadcast(&ctx->produced);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return NULL;
+}
+
+static void *pipeline_consume(void *arg)
+{
+    struct pipeline_reader *reader = arg;
+    struct pipeline_ctx *ctx = reader->ctx;
+    const struct pipeline_consumer *consumer = reader->consumer;
+
+    for (size_t idx = 0; idx < ctx->count; ++idx) {
+        size_t slot = idx % ctx->window;
+
+        pthread_mutex_lock(&ctx->lock);
+        while (ctx->filled[slot] != idx + 1)
+            pthread_cond_wait(&ctx->produced, &ctx->lock);
+        pthread_mutex_unlock(&ctx->lock);
+
+        consumer->consume(consumer->data, idx, slot);
+
+        /* A slot can only be reused once every consumer is past it */
+        pthread_mutex_lock(&ctx->lock);
+        ctx->progress[reader->id] = idx + 1;
+
+        size_t done = ctx->count;
+        for (size_t i = 0; i < ctx->nconsumers; ++i) {
+            if (ctx->progress[i] < done)
+                done = ctx->progress[i];
+        }
+
+        if (done != ctx->done) {
+            ctx->done = done;
+            pthread_cond_broadcast(&ctx->consumed);
+        }
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    if (consumer->finish)
+        consumer->finish(consumer->data);
+
+    return NULL;
+}
+
+static void spawn_thread(pthread_t *thread, void *(*fn)(void *), void *arg)
+{
+    int rc = pthread_create(thread, NULL, fn, arg);
+    if (rc != 0) {
+        errno = rc;
+        err(EXIT_FAILURE, "failed to spawn worker thread");
+    }
+}
+
+/* Run produce over every index in [0, count) on worker threads while
+ * each consumer sees the results in index order, on its own thread,
+ * finishing with its finish callback. Workers never get more than
+ * window indices ahead of the slowest consumer, and each index is
+ * handed the slot idx % window to stage its result in, so callers need
+ * window slots worth of state. Consumers only read from a slot. With
+ * jobs <= 1 everything runs serially through slot 0. */
+void parallel_pipeline(int jobs, size_t count, size_t window,
+                       pipeline_fn produce, void *data,
+                       const struct pipeline_consumer *consumers, size_t nconsumers)
+{
+    if (jobs <= 1 || window == 0) {
+        for (size_t idx = 0; idx < count; ++idx) {
+            produce(data, idx, 0);
+            for (size_t i = 0; i < nconsumers; ++i)
+                consumers[i].consume(consumers[i].data, idx, 0);
+        }
+        for (size_t i = 0; i < nconsumers; ++i) {
+            if (consumers[i].finish)
+                consumers[i].finish(consumers[i].data);
+        }
+        return;
+    }
+
+    struct pipeline_ctx ctx = {
+        .produce = produce,
+        .data = data,
+        .count = count,
+        .window = window,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .produced = PTHREAD_COND_INITIALIZER,
+        .consumed = PTHREAD_COND_INITIALIZER,
+        .nconsumers = nconsumers,
+    };
+
+    ctx.filled = calloc(window, sizeof(size_t));
+    ctx.progress = calloc(nconsumers, sizeof(size_t));
+    check_null(ctx.filled, "failed to allocate pipeline");
+    check_null(ctx.progress, "failed to allocate pipeline");
+
+    /* The calling thread is the first consumer */
+    int workers = jobs > (int)nconsumers ? jobs - (int)nconsumers : 1;
+    size_t nthreads = workers + nconsumers - 1;
+
+    _cleanup_free_ pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    _cleanup_free_ struct pipeline_reader *readers = calloc(nconsumers, sizeof(struct pipeline_reader));
+    check_null(threads, "failed to allocate worker threads");
+    check_null(readers, "failed to allocate worker threads");
+
+    for (size_t i = 0; i < nconsumers; ++i)
+        readers[i] = (struct pipeline_reader){ &ctx, &consumers[i], i };
+
+    for (int i = 0; i < workers; ++i)
+        spawn_thread(&threads[i], pipeline_worker, &ctx);
+    for (size_t i = 1; i < nconsumers; ++i)
+        spawn_thread(&threads[workers + i - 1], pipeline_consume, &readers[i]);
+
+    if (nconsumers)
+        pipeline_consume(&readers[0]);
+
+    for (size_t i = 0; i < nthreads; ++i)
+        pthread_join(threads[i], NULL);
+
+    free(ctx.filled);
+    free(ctx.progress);
+}
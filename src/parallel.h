@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef void (*parallel_fn)(void *data, size_t idx);
+
+void parallel_for(int jobs, size_t count, parallel_fn fn, void *data);
+
+typedef void (*pipeline_fn)(void *data, size_t idx, size_t slot);
+
+struct pipeline_consumer {
+    pipeline_fn consume;
+    void (*finish)(void *data);
+    void *data;
+};
+
+void parallel_pipeline(int jobs, size_t count, size_t window,
+                       pipeline_fn produce, void *data,
+                       const struct pipeline_consumer *consumers, size_t nconsumers);
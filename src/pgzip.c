@@ -0,0 +1,182 @@
+#include "pgzip.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <unistd.h>
+#include <archive.h>
+#include <zlib.h>
+
+#include "parallel.h"
+#include "util.h"
+
+/* Parallel gzip: the tarball is cut into fixed size blocks and each one
+ * is deflated as its own gzip member. A gzip file may consist of any
+ * number of concatenated members, so the result is still a plain .tar.gz
+ * as far as libarchive, and therefore pacman, is concerned. */
+#define PGZIP_BLOCK_SIZE 0x100000
+
+struct pgzip_block {
+    unsigned char *in;
+    size_t in_len;
+    unsigned char *out;
+    size_t out_len;
+    size_t out_size;
+    int status;
+};
+
+struct pgzip {
+    int fd;
+    int jobs;
+    int level;
+    size_t filled;
+    struct pgzip_block *blocks;
+};
+
+static void compress_block(void *data, size_t idx)
+{
+    struct pgzip *gz = data;
+    struct pgzip_block *block = &gz->blocks[idx];
+    z_stream stream = {0};
+
+    block->status = deflateInit2(&stream, gz->level, Z_DEFLATED,
+                                 MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+    if (block->status != Z_OK)
+        return;
+
+    size_t bound = deflateBound(&stream, block->in_len);
+    if (bound > block->out_size) {
+        free(block->out);
+        block->out = malloc(bound);
+        if (!block->out) {
+            block->out_size = 0;
+            block->status = Z_MEM_ERROR;
+            deflateEnd(&stream);
+            return;
+        }
+        block->out_size = bound;
+    }
+
+    stream.next_in = block->in;
+    stream.avail_in = block->in_len;
+    stream.next_out = block->out;
+    stream.avail_out = block->out_size;
+
+    block->status = deflate(&stream, Z_FINISH);
+    if (block->status == Z_STREAM_END)
+        block->status = Z_OK;
+    block->out_len = stream.total_out;
+    deflateEnd(&stream);
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len)
+{
+    while (len) {
+        ssize_t nbytes_w = write(fd, buf, len);
+        if (nbytes_w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += nbytes_w;
+        len -= nbytes_w;
+    }
+    return 0;
+}
+
+/* Compress every buffered block in parallel and write the members out
+ * in order */
+static int pgzip_flush(struct archive *archive, struct pgzip *gz)
+{
+    size_t count = gz->filled;
+    if (count < (size_t)gz->jobs && gz->blocks[count].in_len)
+        ++count;
+    if (count == 0)
+        return 0;
+
+    parallel_for(gz->jobs, count, compress_block, gz);
+
+    for (size_t i = 0; i < count; ++i) {
+        struct pgzip_block *block = &gz->blocks[i];
+        if (block->status != Z_OK) {
+            archive_set_error(archive, EIO, "failed to compress database: %s",
+                              zError(block->status));
+            return -1;
+        }
+        if (write_all(gz->fd, block->out, block->out_len) < 0) {
+            archive_set_error(archive, errno, "failed to write database");
+            return -1;
+        }
+        block->in_len = 0;
+    }
+
+    gz->filled = 0;
+    return 0;
+}
+
+static ssize_t pgzip_write(struct archive *archive, void *data, const void *buf, size_t len)
+{
+    struct pgzip *gz = data;
+    const unsigned char *p = buf;
+    size_t remaining = len;
+
+    while (remaining) {
+        struct pgzip_block *block = &gz->blocks[gz->filled];
+        size_t space = PGZIP_BLOCK_SIZE - block->in_len;
+        size_t n = remaining < space ? remaining : space;
+
+        memcpy(block->in + block->in_len, p, n);
+        block->in_len += n;
+        p += n;
+        remaining -= n;
+
+        if (block->in_len == PGZIP_BLOCK_SIZE && ++gz->filled == (size_t)gz->jobs) {
+            if (pgzip_flush(archive, gz) < 0)
+                return -1;
+        }
+    }
+
+    return len;
+}
+
+static void pgzip_free(struct pgzip *gz)
+{
+    for (int i = 0; i < gz->jobs; ++i) {
+        free(gz->blocks[i].in);
+        free(gz->blocks[i].out);
+    }
+    free(gz->blocks);
+    free(gz);
+}
+
+static int pgzip_close(struct archive *archive, void *data)
+{
+    struct pgzip *gz = data;
+    int ret = pgzip_flush(archive, gz);
+
+    pgzip_free(gz);
+    return ret == 0 ? ARCHIVE_OK : ARCHIVE_FATAL;
+}
+
+int archive_write_open_pgzip(struct archive *archive, int fd, int jobs, int level)
+{
+    struct pgzip *gz = malloc(sizeof(struct pgzip));
+    check_null(gz, "failed to allocate compressor");
+
+    *gz = (struct pgzip){
+        .fd = fd,
+        .jobs = jobs < 1 ? 1 : jobs,
+        .level = level < 0 ? Z_DEFAULT_COMPRESSION : level,
+    };
+
+    gz->blocks = calloc(gz->jobs, sizeof(struct pgzip_block));
+    check_null(gz->blocks, "failed to allocate compressor");
+
+    for (int i = 0; i < gz->jobs; ++i) {
+        gz->blocks[i].in = malloc(PGZIP_BLOCK_SIZE);
+        check_null(gz->blocks[i].in, "failed to allocate compressor");
+    }
+
+    return archive_write_open(archive, gz, NULL, pgzip_write, pgzip_close);
+}
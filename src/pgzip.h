@@ -0,0 +1,5 @@
+#pragma once
+
+struct archive;
+
+int archive_write_open_pgzip(struct archive *archive, int fd, int jobs, int level);
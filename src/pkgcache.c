@@ -1,314 +1,327 @@
 #include "pkgcache.h"
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 
-hash_t sdbm(const char *str)
+/* A wyhash-style string hash: the key is consumed sixteen bytes at a
+ * time and folded together with full 64x64->128 bit multiplies. */
+static const uint64_t hash_k0 = 0xa0761d6478bd642full;
+static const uint64_t hash_k1 = 0xe7037ed1a0b428dbull;
+static const uint64_t hash_k2 = 0x8ebc6af09c88c6e3ull;
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
 {
-    hash_t c;
-    hash_t hash = 0;
+    __extension__ unsigned __int128 r = (unsigned __int128)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
 
-    if (!str) {
-        return hash;
-    }
-    while ((c = *str++)) {
-        hash = c + hash * 65599;
+static inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+hash_t strnhash(const char *str, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)str;
+    uint64_t seed = hash_k0;
+    uint64_t a, b;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            const size_t mid = (len >> 3) << 2;
+            a = read32(p) << 32 | read32(p + mid);
+            b = read32(p + len - 4) << 32 | read32(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = (uint64_t)p[0] << 16 | (uint64_t)p[len >> 1] << 8 | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t left = len;
+        while (left > 16) {
+            seed = hash_mix(read64(p) ^ hash_k1, read64(p + 8) ^ seed);
+            p += 16;
+            left -= 16;
+        }
+        a = read64(p + left - 16);
+        b = read64(p + left - 8);
     }
 
-    return hash;
+    return hash_mix(hash_k2 ^ len, hash_mix(a ^ hash_k1, b ^ seed));
 }
 
-static int pkg_cmp(const void *p1, const void *p2)
+hash_t strhash(const char *str)
 {
-    const struct pkg *pkg1 = p1;
-    const struct pkg *pkg2 = p2;
-    return strcmp(pkg1->name, pkg2->name);
+    if (!str)
+        return 0;
+    return strnhash(str, strlen(str));
 }
 
-/* List of primes for possible sizes of hash tables.
+/* The table is a power of two sized array of slots, open addressed
+ * with Robin Hood linear probing. Each slot keeps the full hash of its
+ * package inline next to an index into the insertion-order array, so
+ * probing only touches the package itself on a full hash match.
  *
- * The maximum table size is the last prime under 1,000,000.  That is
- * more than an order of magnitude greater than the number of packages
- * in any Linux distribution, and well under UINT_MAX.
- */
-static const size_t prime_list[] =
+ * An index of zero marks an empty slot; occupied slots store the
+ * position in the order array plus one. Removed packages leave a hole
+ * in the order array, which is squeezed out the next time it needs to
+ * grow or is sorted. */
+static const size_t min_buckets = 16;
+
+/* Keep the table at most 80% full */
+static inline bool over_limit(size_t entries, size_t buckets)
 {
-    11u, 13u, 17u, 19u, 23u, 29u, 31u, 37u, 41u, 43u, 47u,
-    53u, 59u, 61u, 67u, 71u, 73u, 79u, 83u, 89u, 97u, 103u,
-    109u, 113u, 127u, 137u, 139u, 149u, 157u, 167u, 179u, 193u,
-    199u, 211u, 227u, 241u, 257u, 277u, 293u, 313u, 337u, 359u,
-    383u, 409u, 439u, 467u, 503u, 541u, 577u, 619u, 661u, 709u,
-    761u, 823u, 887u, 953u, 1031u, 1109u, 1193u, 1289u, 1381u,
-    1493u, 1613u, 1741u, 1879u, 2029u, 2179u, 2357u, 2549u,
-    2753u, 2971u, 3209u, 3469u, 3739u, 4027u, 4349u, 4703u,
-    5087u, 5503u, 5953u, 6427u, 6949u, 7517u, 8123u, 8783u,
-    9497u, 10273u, 11113u, 12011u, 12983u, 14033u, 15173u,
-    16411u, 17749u, 19183u, 20753u, 22447u, 24281u, 26267u,
-    28411u, 30727u, 33223u, 35933u, 38873u, 42043u, 45481u,
-    49201u, 53201u, 57557u, 62233u, 67307u, 72817u, 78779u,
-    85229u, 92203u, 99733u, 107897u, 116731u, 126271u, 136607u,
-    147793u, 159871u, 172933u, 187091u, 202409u, 218971u, 236897u,
-    256279u, 277261u, 299951u, 324503u, 351061u, 379787u, 410857u,
-    444487u, 480881u, 520241u, 562841u, 608903u, 658753u, 712697u,
-    771049u, 834181u, 902483u, 976369u
-};
-
-/* How far forward do we look when linear probing for a spot? */
-static const size_t stride = 1;
-/* What is the maximum load percentage of our hash table? */
-static const double max_hash_load = 0.68;
-/* Initial load percentage given a certain size */
-static const double initial_hash_load = 0.58;
+    return entries >= buckets / 5 * 4;
+}
 
-/* Allocate a hash table with space for at least "size" elements */
-struct pkgcache *pkgcache_create(size_t size)
+static size_t buckets_for(size_t size)
 {
-    struct pkgcache *cache = NULL;
-    size_t i, loopsize;
+    size_t buckets = min_buckets;
+    while (over_limit(size, buckets))
+        buckets <<= 1;
+    return buckets;
+}
 
-    cache = calloc(1, sizeof(struct pkgcache));
-    if (!cache)
-        return NULL;
+static inline size_t probe_distance(const struct pkgcache *cache, hash_t hash,
+                                    size_t position)
+{
+    return (position - hash) & (cache->buckets - 1);
+}
 
-    size = size / initial_hash_load + 1;
+static void insert_slot(struct pkgcache *cache, hash_t hash, size_t index)
+{
+    const size_t mask = cache->buckets - 1;
+    struct pkgcache_slot entry = { hash, index };
+    size_t position = hash & mask, distance = 0;
+
+    for (;; position = (position + 1) & mask, ++distance) {
+        struct pkgcache_slot *slot = &cache->slots[position];
+        if (!slot->index) {
+            *slot = entry;
+            return;
+        }
 
-    loopsize = sizeof(prime_list) / sizeof(*prime_list);
-    for (i = 0; i < loopsize; i++) {
-        if (prime_list[i] > size) {
-            cache->buckets = prime_list[i];
-            cache->limit = cache->buckets * max_hash_load;
-            break;
+        /* Steal the slot from any entry closer to its home bucket */
+        size_t existing = probe_distance(cache, slot->hash, position);
+        if (existing < distance) {
+            struct pkgcache_slot tmp = *slot;
+            *slot = entry;
+            entry = tmp;
+            distance = existing;
         }
     }
+}
 
-    if (cache->buckets < size) {
-        errno = ERANGE;
-        free(cache);
-        return NULL;
-    }
+static struct pkgcache_slot *find_slot(struct pkgcache *cache, hash_t hash,
+                                       const char *name)
+{
+    const size_t mask = cache->buckets - 1;
+    size_t position = hash & mask, distance = 0;
 
-    cache->hash_table = calloc(cache->buckets, sizeof(alpm_list_t *));
-    if (!cache->hash_table) {
-        free(cache);
-        return NULL;
-    }
+    for (;; position = (position + 1) & mask, ++distance) {
+        struct pkgcache_slot *slot = &cache->slots[position];
+        if (!slot->index || probe_distance(cache, slot->hash, position) < distance)
+            return NULL;
 
-    return cache;
+        if (slot->hash == hash && strcmp(cache->order[slot->index - 1]->name, name) == 0)
+            return slot;
+    }
 }
 
-static size_t get_hash_position(hash_t hash, struct pkgcache *cache)
+/* Backward shift deletion: pull every following entry which isn't in
+ * its home bucket back by one, so no tombstones are needed. */
+static void remove_slot(struct pkgcache *cache, struct pkgcache_slot *slot)
 {
-    size_t position;
+    const size_t mask = cache->buckets - 1;
+    size_t position = slot - cache->slots;
 
-    position = hash % cache->buckets;
+    for (;;) {
+        size_t next = (position + 1) & mask;
+        const struct pkgcache_slot *following = &cache->slots[next];
+        if (!following->index || probe_distance(cache, following->hash, next) == 0)
+            break;
 
-    /* collision resolution using open addressing with linear probing */
-    while (cache->hash_table[position] != NULL) {
-        position += stride;
-        while (position >= cache->buckets) {
-            position -= cache->buckets;
-        }
+        cache->slots[position] = *following;
+        position = next;
     }
 
-    return position;
+    cache->slots[position] = (struct pkgcache_slot){0};
 }
 
-/* Expand the hash table size to the next increment and rebin the entries */
-static struct pkgcache *rehash(struct pkgcache *oldcache)
+static void reinsert_slots(struct pkgcache *cache)
 {
-    struct pkgcache *newcache;
-    size_t newsize, i;
-
-    /* Hash tables will need resized in two cases:
-     *  - adding packages to the local database
-     *  - poor estimation of the number of packages in sync database
-     *
-     * For small hash tables sizes (<500) the increase in size is by a
-     * minimum of a factor of 2 for optimal rehash efficiency.  For
-     * larger database sizes, this increase is reduced to avoid excess
-     * memory allocation as both scenarios requiring a rehash should not
-     * require a table size increase that large. */
-    if (oldcache->buckets < 500) {
-        newsize = oldcache->buckets * 2;
-    } else if (oldcache->buckets < 2000) {
-        newsize = oldcache->buckets * 3 / 2;
-    } else if (oldcache->buckets < 5000) {
-        newsize = oldcache->buckets * 4 / 3;
-    } else {
-        newsize = oldcache->buckets + 1;
+    for (size_t i = 0; i < cache->count; ++i) {
+        if (cache->order[i])
+            insert_slot(cache, cache->order[i]->hash, i + 1);
     }
+}
+
+static int rebuild_slots(struct pkgcache *cache, size_t buckets)
+{
+    struct pkgcache_slot *slots = calloc(buckets, sizeof(struct pkgcache_slot));
+    if (!slots)
+        return -1;
+
+    free(cache->slots);
+    cache->slots = slots;
+    cache->buckets = buckets;
+    reinsert_slots(cache);
+    return 0;
+}
 
-    newcache = pkgcache_create(newsize);
-    if (newcache == NULL) {
-        /* creation of newcache failed, stick with old one... */
-        return oldcache;
+/* Returns true if any package moved, leaving the slots stale */
+static bool compact_order(struct pkgcache *cache)
+{
+    size_t live = 0;
+    for (size_t i = 0; i < cache->count; ++i) {
+        if (cache->order[i])
+            cache->order[live++] = cache->order[i];
     }
 
-    newcache->list = oldcache->list;
-    oldcache->list = NULL;
+    bool moved = live != cache->count;
+    cache->count = live;
+    return moved;
+}
 
-    for (i = 0; i < oldcache->buckets; i++) {
-        if (oldcache->hash_table[i] != NULL) {
-            struct pkg *package = oldcache->hash_table[i]->data;
-            size_t position = get_hash_position(package->hash, newcache);
+/* Make room for one more package at the end of the order array,
+ * either by squeezing out holes or by growing it. */
+static int reserve_order(struct pkgcache *cache)
+{
+    if (cache->count < cache->size)
+        return 0;
 
-            newcache->hash_table[position] = oldcache->hash_table[i];
-            oldcache->hash_table[i] = NULL;
-        }
+    if (cache->count - cache->entries > cache->count / 2) {
+        compact_order(cache);
+        return rebuild_slots(cache, cache->buckets);
     }
 
-    newcache->entries = oldcache->entries;
+    size_t size = cache->size ? cache->size * 2 : min_buckets;
+    struct pkg **order = realloc(cache->order, size * sizeof(struct pkg *));
+    if (!order)
+        return -1;
 
-    pkgcache_free(oldcache);
-
-    return newcache;
+    cache->order = order;
+    cache->size = size;
+    return 0;
 }
 
-static struct pkgcache *pkgcache_add_pkg(struct pkgcache *cache, struct pkg *pkg,
-                                         int sorted)
+/* Allocate a hash table with space for at least "size" elements */
+struct pkgcache *pkgcache_create(size_t size)
 {
-    alpm_list_t *ptr;
-    size_t position;
+    struct pkgcache *cache = calloc(1, sizeof(struct pkgcache));
+    if (!cache)
+        return NULL;
 
-    if (pkg == NULL || cache == NULL) {
-        return cache;
-    }
+    arena_init(&cache->arena);
 
-    if (cache->entries >= cache->limit) {
-        cache = rehash(cache);
+    cache->buckets = buckets_for(size);
+    cache->size = size > min_buckets ? size : min_buckets;
+    cache->slots = calloc(cache->buckets, sizeof(struct pkgcache_slot));
+    cache->order = malloc(cache->size * sizeof(struct pkg *));
+    if (!cache->slots || !cache->order) {
+        pkgcache_free(cache);
+        return NULL;
     }
 
-    position = get_hash_position(pkg->hash, cache);
+    return cache;
+}
 
-    ptr = malloc(sizeof(alpm_list_t));
-    if (ptr == NULL) {
+struct pkgcache *pkgcache_add(struct pkgcache *cache, struct pkg *pkg)
+{
+    if (pkg == NULL || cache == NULL)
         return cache;
-    }
-
-    ptr->data = pkg;
-    ptr->prev = ptr;
-    ptr->next = NULL;
 
-    cache->hash_table[position] = ptr;
-    if (!sorted) {
-        cache->list = alpm_list_join(cache->list, ptr);
-    } else {
-        cache->list = alpm_list_mmerge(cache->list, ptr, pkg_cmp);
+    if (over_limit(cache->entries + 1, cache->buckets) &&
+        rebuild_slots(cache, cache->buckets * 2) < 0 &&
+        cache->entries + 1 >= cache->buckets) {
+        return cache;
     }
 
+    if (reserve_order(cache) < 0)
+        return cache;
+
+    cache->order[cache->count++] = pkg;
     cache->entries += 1;
+    insert_slot(cache, pkg->hash, cache->count);
     return cache;
 }
 
-
-struct pkgcache *pkgcache_add(struct pkgcache *cache, struct pkg *pkg)
-{
-    return pkgcache_add_pkg(cache, pkg, 0);
-}
-
 struct pkgcache *pkgcache_replace(struct pkgcache *cache, struct pkg *new, struct pkg *old)
 {
     cache = pkgcache_remove(cache, old, NULL);
     return pkgcache_add(cache, new);
+}
 
+static int pkg_cmp(const void *p1, const void *p2)
+{
+    const struct pkg *pkg1 = *(struct pkg * const *)p1;
+    const struct pkg *pkg2 = *(struct pkg * const *)p2;
+    return strcmp(pkg1->name, pkg2->name);
 }
 
-struct pkgcache *pkgcache_add_sorted(struct pkgcache *cache, struct pkg *pkg)
+static bool is_sorted(const struct pkgcache *cache)
 {
-    return pkgcache_add_pkg(cache, pkg, 1);
+    for (size_t i = 1; i < cache->count; ++i) {
+        if (strcmp(cache->order[i - 1]->name, cache->order[i]->name) > 0)
+            return false;
+    }
+    return true;
 }
 
-static size_t move_one_entry(struct pkgcache *cache,
-                             size_t start, size_t end)
+/* Put the packages in name order. Databases are usually read back in
+ * the order they were written, so check for that before sorting. */
+void pkgcache_sort(struct pkgcache *cache)
 {
-    /* Iterate backwards from 'end' to 'start', seeing if any of the items
-     * would hash to 'start'. If we find one, we move it there and break.  If
-     * we get all the way back to position and find none that hash to it, we
-     * also end iteration. Iterating backwards helps prevent needless shuffles;
-     * we will never need to move more than one item per function call.  The
-     * return value is our current iteration location; if this is equal to
-     * 'start' we can stop this madness. */
-    while (end != start) {
-        alpm_list_t *i = cache->hash_table[end];
-        struct pkg *info = i->data;
-        size_t new_position = get_hash_position(info->hash, cache);
-
-        if (new_position == start) {
-            cache->hash_table[start] = i;
-            cache->hash_table[end] = NULL;
-            break;
-        }
+    if (cache == NULL)
+        return;
+
+    bool moved = compact_order(cache);
+    bool sorted = is_sorted(cache);
+    if (!sorted)
+        qsort(cache->order, cache->count, sizeof(struct pkg *), pkg_cmp);
 
-        /* the odd math ensures we are always positive, e.g.
-         * e.g. (0 - 1) % 47      == -1
-         * e.g. (47 + 0 - 1) % 47 == 46 */
-        end = (cache->buckets + end - stride) % cache->buckets;
+    if (moved || !sorted) {
+        memset(cache->slots, 0, cache->buckets * sizeof(struct pkgcache_slot));
+        reinsert_slots(cache);
     }
-    return end;
 }
 
 struct pkgcache *pkgcache_remove(struct pkgcache *cache, struct pkg *pkg,
                                  struct pkg **data)
 {
-    alpm_list_t *i;
-    size_t position;
-
-    if (data) {
+    if (data)
         *data = NULL;
-    }
 
-    if (pkg == NULL || cache == NULL) {
+    if (pkg == NULL || cache == NULL)
         return cache;
-    }
 
-    position = pkg->hash % cache->buckets;
-    while ((i = cache->hash_table[position]) != NULL) {
-        struct pkg *info = i->data;
-
-        if (info->hash == pkg->hash &&
-           strcmp(info->name, pkg->name) == 0) {
-            size_t stop, prev;
-
-            /* remove from list and hash */
-            cache->list = alpm_list_remove_item(cache->list, i);
-            if (data) {
-                *data = info;
-            }
-            cache->hash_table[position] = NULL;
-            free(i);
-            cache->entries -= 1;
-
-            /* Potentially move entries following removed entry to keep open
-             * addressing collision resolution working. We start by finding the
-             * next null bucket to know how far we have to look. */
-            stop = position + stride;
-            while (stop >= cache->buckets) {
-                stop -= cache->buckets;
-            }
-            while (cache->hash_table[stop] != NULL && stop != position) {
-                stop += stride;
-                while (stop >= cache->buckets) {
-                    stop -= cache->buckets;
-                }
-            }
-            stop = (cache->buckets + stop - stride) % cache->buckets;
-
-            /* We now search backwards from stop to position. If we find an
-             * item that now hashes to position, we will move it, and then try
-             * to plug the new hole we just opened up, until we finally don't
-             * move anything. */
-            while ((prev = move_one_entry(cache, position, stop)) != position) {
-                position = prev;
-            }
-
-            return cache;
-        }
+    struct pkgcache_slot *slot = find_slot(cache, pkg->hash, pkg->name);
+    if (!slot)
+        return cache;
 
-        position += stride;
-        while (position >= cache->buckets) {
-            position -= cache->buckets;
-        }
-    }
+    if (data)
+        *data = cache->order[slot->index - 1];
+
+    cache->order[slot->index - 1] = NULL;
+    cache->entries -= 1;
+    remove_slot(cache, slot);
+
+    /* Trim holes off the end, iteration stays safe since it checks
+     * against the count on every step */
+    while (cache->count && !cache->order[cache->count - 1])
+        cache->count -= 1;
 
     return cache;
 }
@@ -316,39 +329,18 @@ struct pkgcache *pkgcache_remove(struct pkgcache *cache, struct pkg *pkg,
 void pkgcache_free(struct pkgcache *cache)
 {
     if (cache != NULL) {
-        size_t i;
-        for (i = 0; i < cache->buckets; i++) {
-            free(cache->hash_table[i]);
-        }
-        free(cache->hash_table);
+        free(cache->slots);
+        free(cache->order);
+        arena_release(&cache->arena);
     }
     free(cache);
 }
 
 struct pkg *pkgcache_find(struct pkgcache *cache, const char *name)
 {
-    alpm_list_t *lp;
-    size_t position;
-
-    if (name == NULL || cache == NULL) {
+    if (name == NULL || cache == NULL)
         return NULL;
-    }
-
-    hash_t hash = sdbm(name);
-    position = hash % cache->buckets;
-
-    while ((lp = cache->hash_table[position]) != NULL) {
-        struct pkg *info = lp->data;
-
-        if (info->hash == hash && strcmp(info->name, name) == 0) {
-            return info;
-        }
-
-        position += stride;
-        while (position >= cache->buckets) {
-            position -= cache->buckets;
-		}
-	}
 
-	return NULL;
+    const struct pkgcache_slot *slot = find_slot(cache, strhash(name), name);
+    return slot ? cache->order[slot->index - 1] : NULL;
 }
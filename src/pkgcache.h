@@ -5,23 +5,50 @@
 #include <alpm.h>
 #include <alpm_list.h>
 #include "package.h"
+#include "arena.h"
+
+struct pkgcache_slot {
+    hash_t hash;
+    size_t index;
+};
 
 struct pkgcache {
-    alpm_list_t **hash_table;
-    alpm_list_t *list;
+    struct pkgcache_slot *slots;
+    struct pkg **order;
     size_t buckets;
     size_t entries;
-    size_t limit;
+    size_t count;
+    size_t size;
+
+    /* Backs the packages loaded out of existing databases */
+    struct arena arena;
 };
 
-hash_t sdbm(const char *str);
+hash_t strhash(const char *str);
+hash_t strnhash(const char *str, size_t len);
 
 struct pkgcache *pkgcache_create(size_t size);
 void pkgcache_free(struct pkgcache *cache);
 
 struct pkgcache *pkgcache_add(struct pkgcache *cache, struct pkg *pkg);
 struct pkgcache *pkgcache_replace(struct pkgcache *cache, struct pkg *new, struct pkg *old);
-struct pkgcache *pkgcache_add_sorted(struct pkgcache *cache, struct pkg *pkg);
 struct pkgcache *pkgcache_remove(struct pkgcache *cache, struct pkg *pkg, struct pkg **data);
+void pkgcache_sort(struct pkgcache *cache);
 
 struct pkg *pkgcache_find(struct pkgcache *cache, const char *name);
+
+/* Packages are visited in insertion order, or in name order right after
+ * pkgcache_sort(). Removing the current package while iterating is
+ * safe, adding one is not. */
+static inline struct pkg *pkgcache_next(const struct pkgcache *cache, size_t *iter)
+{
+    while (*iter < cache->count) {
+        struct pkg *pkg = cache->order[(*iter)++];
+        if (pkg)
+            return pkg;
+    }
+    return NULL;
+}
+
+#define pkgcache_foreach(cache, pkg) \
+    for (size_t _iter = 0; ((pkg) = pkgcache_next((cache), &_iter)); )
@@ -10,6 +10,7 @@ struct archive;
 struct pkginfo_parser {
     int cs;
     enum pkg_entry entry;
+    const char *mark;
     size_t pos;
     char store[LINE_MAX];
 };
@@ -1,28 +1,33 @@
 #include "pkginfo.h"
 
+#include <string.h>
 #include <err.h>
+#include <archive.h>
 #include "package.h"
 #include "util.h"
 
 %%{
     machine pkginfo;
 
-    action store {
-        parser->store[parser->pos++] = fc;
-        if (parser->pos == LINE_MAX) {
-            errx(1, "desc line too long");
-        }
+    action mark {
+        parser->mark = fpc;
     }
 
     action emit {
+        const char *entry = parser->mark;
+        size_t entry_len = fpc - parser->mark;
+
+        /* The value started in an earlier block */
         if (parser->pos) {
-            const char *entry = parser->store;
-            const size_t entry_len = parser->pos;
-            parser->store[parser->pos] = 0;
+            pkginfo_parser_carry(parser, entry, entry_len);
+            entry = parser->store;
+            entry_len = parser->pos;
             parser->pos = 0;
+        }
+        parser->mark = NULL;
 
+        if (entry_len)
             package_set(pkg, parser->entry, entry, entry_len);
-        }
     }
 
     header = 'pkgname'     %{ parser->entry = PKG_PKGNAME; }
@@ -46,7 +51,7 @@
            | 'backup'      %{ parser->entry = PKG_BACKUP; }
            | 'makepkgopt'  %{ parser->entry = PKG_MAKEPKGOPT; };
 
-    entry = header ' = ' [^\n]* @store %emit '\n';
+    entry = header ' = ' %mark [^\n]* %emit '\n';
     comment = '#' [^\n]* '\n';
 
     main := ( entry | comment )*;
@@ -54,6 +59,15 @@
 
 %%write data nofinal;
 
+static void pkginfo_parser_carry(struct pkginfo_parser *parser, const char *p, size_t len)
+{
+    if (parser->pos + len >= LINE_MAX)
+        errx(1, "pkginfo line too long");
+
+    memcpy(&parser->store[parser->pos], p, len);
+    parser->pos += len;
+}
+
 void pkginfo_parser_init(struct pkginfo_parser *parser)
 {
     *parser = (struct pkginfo_parser){0};
@@ -61,12 +75,18 @@ void pkginfo_parser_init(struct pkginfo_parser *parser)
     %%write init;
 }
 
+/* Values are handed to package_set() as spans straight out of buf. Only
+ * a value that's cut off by the end of buf gets copied, so it can be
+ * completed by the next call. */
 ssize_t pkginfo_parser_feed(struct pkginfo_parser *parser, struct pkg *pkg,
-                         char *buf, size_t buf_len)
+                            char *buf, size_t buf_len)
 {
     char *p = buf;
     char *pe = p + buf_len;
 
+    if (parser->pos)
+        parser->mark = p;
+
     %%access parser->;
     %%write exec;
 
@@ -74,28 +94,34 @@ ssize_t pkginfo_parser_feed(struct pkginfo_parser *parser, struct pkg *pkg,
     if (parser->cs == pkginfo_error)
         return -1;
 
+    if (parser->mark) {
+        pkginfo_parser_carry(parser, parser->mark, pe - parser->mark);
+        parser->mark = NULL;
+    }
+
     return buf_len;
 }
 
 ssize_t read_pkginfo(struct archive *archive, struct pkg *pkg)
 {
-    char *buf;
     ssize_t nbytes_r = 0;
     struct pkginfo_parser parser;
     pkginfo_parser_init(&parser);
 
     for (;;) {
+        char *buf;
         size_t bufsize;
-        archive_read(archive, &buf, &bufsize);
+
+        int status = archive_read(archive, &buf, &bufsize);
+        if (status == ARCHIVE_EOF)
+            break;
+        if (status != ARCHIVE_OK)
+            return -1;
 
         ssize_t result = pkginfo_parser_feed(&parser, pkg, buf, bufsize);
-        if (result < 0) {
+        if (result < 0)
             return result;
-        } else {
-            nbytes_r += result;
-        }
-
-        break;
+        nbytes_r += result;
     }
 
     return nbytes_r;
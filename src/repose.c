@@ -16,20 +16,25 @@
 #include <alpm_list.h>
 #include <sys/utsname.h>
 #include <sys/stat.h>
-#include <sys/ioctl.h>
-#include <linux/btrfs.h>
 #include <locale.h>
+#include <limits.h>
 
 #include "database.h"
 #include "filecache.h"
 #include "package.h"
 #include "pkgcache.h"
 #include "filters.h"
+#include "link.h"
+#include "scancache.h"
+#include "snapshot.h"
+#include "sync.h"
 #include "signing.h"
+#include "intern.h"
+#include "version.h"
 #include "base64.h"
 #include "util.h"
 
-struct config config = {0};
+struct config config = { .compression_level = -1 };
 
 void trace(const char *fmt, ...)
 {
@@ -60,8 +65,16 @@ static _noreturn_ void usage(FILE *out)
           " -J, --xz              filter the archive through xz\n"
           " -z, --gzip            filter the archive through gzip\n"
           " -Z, --compress        filter the archive through compress\n"
-          "     --reflink         make repose make reflinks instead of symlinks\n"
-          "     --rebuild         force rebuild the repo\n", out);
+          "     --zstd            filter the archive through zstd\n"
+          "     --compression-level=N\n"
+          "                       set the compression level\n"
+          "     --jobs=N          load packages using N parallel jobs\n"
+          "     --checksum-xattr  remember package checksums in an xattr\n"
+          "     --link=MODE       link packages into the root with MODE: auto,\n"
+          "                       reflink, copy, hardlink or symlink (default)\n"
+          "     --reflink         same as --link=reflink\n"
+          "     --rebuild         force rebuild the repo\n"
+          "     --relink          link every package, not just new ones\n", out);
 
     exit(out == stderr ? EXIT_FAILURE : EXIT_SUCCESS);
 }
@@ -101,93 +114,35 @@ static _noreturn_ void elephant(void)
     exit(EXIT_SUCCESS);
 }
 
-static int clone_file(const struct repo *repo, const char *filename)
+/* Only the packages the sync plan added or updated need linking, the
+ * rest were linked on an earlier run. A relink walks the whole cache. */
+static void link_db(struct repo *repo, bool relink)
 {
-    _cleanup_close_ int src = openat(repo->poolfd, filename, O_RDONLY);
-    if (src < 0)
-	return src;
-
-    _cleanup_close_ int dest = openat(repo->rootfd, filename, O_WRONLY | O_TRUNC, 0664);
-    if (dest < 0 && errno == ENOENT) {
-        dest = openat(repo->rootfd, filename, O_WRONLY | O_CREAT, 0664);
-    }
-    if (dest < 0)
-	return dest;
-
-    return ioctl(dest, BTRFS_IOC_CLONE, src);
-}
-
-static int symlink_file(const struct repo *repo, const char *path1, const char *path2)
-{
-    _cleanup_free_ char* canonical_path1 = canonicalize_file_name(path1);
-    int ret = symlinkat(canonical_path1, repo->rootfd, path2);
-    if (ret < 0 && errno == EEXIST)
-        return 0;
-    return ret;
-}
-
-static inline int unlink_file(const struct repo *repo, const char *filename)
-{
-    struct stat st;
-    if (fstatat(repo->rootfd, filename, &st, AT_SYMLINK_NOFOLLOW) < 0)
-        return errno != ENOENT ? -1 : 0;
-    if (S_ISLNK(st.st_mode))
-        return unlinkat(repo->rootfd, filename, 0);
-    return 0;
-}
-
-static int clone_pkg(const struct repo *repo, const struct pkg *pkg)
-{
-    _cleanup_free_ char *signame = joinstring(pkg->filename, ".sig", NULL);
-    if (clone_file(repo, signame) < 0 && errno != ENOENT)
-	err(1, "failed to clone signature %s", signame);
-
-    return clone_file(repo, pkg->filename);
-}
-
-static int symlink_pkg(const struct repo *repo, const struct pkg *pkg)
-{
-    _cleanup_free_ char *link = joinstring(repo->pool, "/", pkg->filename, NULL);
-    _cleanup_free_ char *siglink = joinstring(link, ".sig", NULL);
+    if (!repo->pool)
+        return;
 
-    if (access(siglink, F_OK) != -1) {
-	_cleanup_free_ char *signame = joinstring(pkg->filename, ".sig", NULL);
-	if (symlink_file(repo, siglink, signame) < 0 && errno != EEXIST)
-	    err(1, "failed to symlink signature %s", signame);
-    }
+    size_t count = relink ? (repo->cache ? repo->cache->entries : 0) : repo->plan.count;
+    if (!count)
+        return;
 
-    return symlink_file(repo, link, pkg->filename);
-}
+    _cleanup_free_ struct pkg **pkgs = malloc(count * sizeof(struct pkg *));
+    check_null(pkgs, "failed to allocate link list");
+    count = 0;
 
-static inline void link_pkg(const struct repo *repo, const struct pkg *pkg)
-{
-    if (config.reflink) {
-        check_posix(clone_pkg(repo, pkg),
-                    "failed to make reflink for %s", pkg->filename);
+    if (relink) {
+        trace("relinking every package\n");
+        struct pkg *pkg;
+        pkgcache_foreach(repo->cache, pkg)
+            pkgs[count++] = pkg;
     } else {
-        check_posix(symlink_pkg(repo, pkg),
-                    "failed to make symlink for %s", pkg->filename);
+        for (size_t i = 0; i < repo->plan.count; ++i) {
+            const struct sync_action *action = &repo->plan.actions[i];
+            if (action->type != SYNC_REMOVE)
+                pkgs[count++] = action->pkg;
+        }
     }
-}
 
-static inline int unlink_pkg(const struct repo *repo, const struct pkg *pkg)
-{
-    int ret = unlink_file(repo, pkg->filename);
-    if (ret < 0)
-        return ret;
-
-    _cleanup_free_ char *signame = joinstring(pkg->filename, ".sig", NULL);
-    return unlink_file(repo, signame);
-}
-
-static void link_db(struct repo *repo)
-{
-    if (!repo->pool)
-        return;
-
-    alpm_list_t *node;
-    for (node = repo->cache->list; node; node = node->next)
-        link_pkg(repo, node->data);
+    link_pkgs(repo, pkgs, count);
 }
 
 static void drop_from_repo(struct repo *repo, alpm_list_t *targets)
@@ -195,9 +150,8 @@ static void drop_from_repo(struct repo *repo, alpm_list_t *targets)
     if (!targets || !repo->cache)
         return;
 
-    alpm_list_t *node;
-    for (node = repo->cache->list; node; node = node->next) {
-        struct pkg *pkg = node->data;
+    struct pkg *pkg;
+    pkgcache_foreach(repo->cache, pkg) {
 
         if (match_targets(pkg, targets)) {
             trace("dropping %s\n", pkg->name);
@@ -212,83 +166,47 @@ static void drop_from_repo(struct repo *repo, alpm_list_t *targets)
 
 static void list_repo(struct repo *repo)
 {
-    alpm_list_t *node;
-    for (node = repo->cache->list; node; node = node->next) {
-        struct pkg *pkg = node->data;
+    struct pkg *pkg;
+    pkgcache_foreach(repo->cache, pkg) {
 
         printf("%s %s\n", pkg->name, pkg->version);
     }
 }
 
-static void reduce_repo(struct repo *repo)
+/* Carry out a sync plan against the database. Dropped and replaced
+ * database packages are freed along the way, leaving only the pool
+ * packages in the plan valid afterwards. */
+static void apply_plan(struct repo *repo, struct sync_plan *plan)
 {
-    if (!repo->cache)
+    if (!plan->count)
         return;
 
-    alpm_list_t *node;
-    for (node = repo->cache->list; node; node = node->next) {
-        struct pkg *pkg = node->data;
-
-        if (faccessat(repo->poolfd, pkg->filename, F_OK, 0) < 0) {
-            if (errno != ENOENT)
-                err(EXIT_FAILURE, "couldn't access package %s", pkg->filename);
-
-            trace("dropping %s\n", pkg->name);
-            repo->cache = pkgcache_remove(repo->cache, pkg, NULL);
-            unlink_pkg(repo, pkg);
-            package_free(pkg);
-            repo->dirty = true;
-        }
-    }
-}
-
-static void update_repo(struct repo *repo, struct pkgcache *src)
-{
     if (!repo->cache)
-        repo->cache = pkgcache_create(src->entries);
+        repo->cache = pkgcache_create(plan->count);
 
-    alpm_list_t *node;
-    for (node = src->list; node; node = node->next) {
-        struct pkg *pkg = node->data;
-        struct pkg *old = pkgcache_find(repo->cache, pkg->name);
+    for (size_t i = 0; i < plan->count; ++i) {
+        struct sync_action *action = &plan->actions[i];
 
-        if (!old) {
-            /* The package isn't already in the database. Just add it */
-            trace("adding %s %s\n", pkg->name, pkg->version);
-            repo->cache = pkgcache_add(repo->cache, pkg);
-            repo->dirty = true;
-            continue;
-        }
-
-        switch (alpm_pkg_vercmp(pkg->version, old->version)) {
-        case 1:
-            /* The filecache package has a newer version than the
-               package in the database. */
-            trace("updating %s %s => %s\n", pkg->name, old->version, pkg->version);
+        switch (action->type) {
+        case SYNC_ADD:
+            repo->cache = pkgcache_add(repo->cache, action->pkg);
+            break;
+        case SYNC_UPDATE:
+            repo->cache = pkgcache_replace(repo->cache, action->pkg, action->old);
+            unlink_pkg(repo, action->pkg);
+            package_free(action->old);
+            action->old = NULL;
             break;
-        case 0:
-            /* The filecache package has the same version as the
-               package in the database. Only update the package if the
-               file is newer than the database */
-            if (pkg->mtime > old->mtime) {
-                trace("updating %s %s [newer timestamp]\n", pkg->name, pkg->version);
-            } else if (pkg->builddate > old->builddate) {
-                trace("updating %s %s [newer build]\n", pkg->name, pkg->version);
-            } else if (old->base64sig == NULL && pkg->base64sig) {
-                trace("adding signature for %s\n", pkg->name);
-            } else {
-                continue;
-            }
+        case SYNC_REMOVE:
+            repo->cache = pkgcache_remove(repo->cache, action->pkg, NULL);
+            unlink_pkg(repo, action->pkg);
+            package_free(action->pkg);
+            action->pkg = NULL;
             break;
-        default:
-            continue;
         }
-
-        repo->cache = pkgcache_replace(repo->cache, pkg, old);
-        unlink_pkg(repo, pkg);
-        package_free(old);
-        repo->dirty = true;
     }
+
+    repo->dirty = true;
 }
 
 static alpm_list_t *parse_targets(char *targets[], int count)
@@ -300,7 +218,13 @@ static alpm_list_t *parse_targets(char *targets[], int count)
     return list;
 }
 
-static int load_db(struct repo *repo, const char *filename)
+/* The desc fields the sync plan and link_db compare, and the
+ * ones the database writer needs to decide if a package needs checksumming */
+static const uint64_t update_fields =
+    PKG_FIELD(PKG_FILENAME) | PKG_FIELD(PKG_BUILDDATE) |
+    PKG_FIELD(PKG_PGPSIG) | PKG_FIELD(PKG_SHA256SUM);
+
+static int load_db(struct repo *repo, const char *filename, uint64_t fields)
 {
     _cleanup_close_ int dbfd = openat(repo->rootfd, filename, O_RDONLY);
     if (dbfd < 0) {
@@ -309,7 +233,7 @@ static int load_db(struct repo *repo, const char *filename)
         return -1;
     }
 
-    if (load_database(dbfd, &repo->cache) < 0) {
+    if (load_database(dbfd, &repo->cache, fields) < 0) {
         warn("failed to open %s database", filename);
         return -1;
     }
@@ -334,7 +258,7 @@ static void check_signature(struct repo *repo, const char *name)
 }
 
 static int init_repo(struct repo *repo, const char *reponame, bool files,
-                     bool load_cache)
+                     bool load_cache, uint64_t fields)
 {
     repo->rootfd = open(repo->root, O_RDONLY | O_DIRECTORY);
     check_posix(repo->rootfd, "failed to open root directory %s", repo->root);
@@ -342,12 +266,18 @@ static int init_repo(struct repo *repo, const char *reponame, bool files,
     if (repo->pool) {
         repo->poolfd = open(repo->pool, O_RDONLY | O_DIRECTORY);
         check_posix(repo->poolfd, "failed to open pool directory %s", repo->pool);
+
+        /* Symlinks into the pool need an absolute path */
+        repo->poolpath = canonicalize_file_name(repo->pool);
+        check_null(repo->poolpath, "failed to resolve pool directory %s", repo->pool);
     } else {
         repo->poolfd = repo->rootfd;
     }
 
     repo->dbname = joinstring(reponame, ".db", NULL);
     repo->filesname = joinstring(reponame, ".files", NULL);
+    repo->scanname = joinstring(reponame, ".scancache", NULL);
+    repo->indexname = joinstring(reponame, ".repose-index", NULL);
 
     if (!files && faccessat(repo->rootfd, repo->filesname, F_OK, 0) < 0) {
         if (errno == ENOENT) {
@@ -367,15 +297,25 @@ static int init_repo(struct repo *repo, const char *reponame, bool files,
     if (load_cache) {
         repo->cache = pkgcache_create(100);
 
-        if (load_db(repo, repo->dbname) < 0) {
+        /* Listing never looks at the files database */
+        if (snapshot_load(repo->rootfd, repo->indexname, repo->dbname,
+                          repo->filesname, fields != 0, &repo->cache) == 0)
+            return 0;
+
+        /* The snapshot is missing or out of date, fall back to the
+           databases and take a new one once we're done */
+        repo->stale_snapshot = true;
+
+        if (load_db(repo, repo->dbname, fields) < 0) {
             /* Database doesn't exist. Mark it dirty so we force its
                generation */
             repo->dirty = true;
             return -1;
         }
 
-        if (repo->filesname)
-            return load_db(repo, repo->filesname);
+        /* Nothing in the files database can be known from pathnames */
+        if (repo->filesname && fields)
+            return load_db(repo, repo->filesname, fields);
     }
 
     return 0;
@@ -406,6 +346,30 @@ static alpm_list_t *load_manifest(struct repo *repo, const char *reponame)
     return list;
 }
 
+static int parse_compression_level(const char *str)
+{
+    size_t level;
+    if (parse_size(str, &level) < 0 || level > INT_MAX)
+        errx(EXIT_FAILURE, "invalid compression level: %s", str);
+    return level;
+}
+
+static int parse_jobs(const char *str)
+{
+    size_t jobs;
+    if (parse_size(str, &jobs) < 0 || jobs == 0 || jobs > INT_MAX)
+        errx(EXIT_FAILURE, "invalid number of jobs: %s", str);
+    return jobs;
+}
+
+static enum link_mode parse_link(const char *str)
+{
+    int mode = parse_link_mode(str);
+    if (mode < 0)
+        errx(EXIT_FAILURE, "invalid link mode: %s", str);
+    return mode;
+}
+
 static char *get_rootname(char *name)
 {
     char *sep = strrchr(name, '.');
@@ -417,7 +381,7 @@ static char *get_rootname(char *name)
 int main(int argc, char *argv[])
 {
     const char *rootname;
-    bool files = false, rebuild = false, drop = false, list = false;
+    bool files = false, rebuild = false, relink = false, drop = false, list = false;
 
     setlocale(LC_ALL, "");
 
@@ -439,6 +403,12 @@ int main(int argc, char *argv[])
         { "reflink",  no_argument,       0, 0x100 },
         { "rebuild",  no_argument,       0, 0x101 },
         { "elephant", no_argument,       0, 0x102 },
+        { "jobs",     required_argument, 0, 0x103 },
+        { "checksum-xattr", no_argument, 0, 0x104 },
+        { "zstd",     no_argument,       0, 0x105 },
+        { "compression-level", required_argument, 0, 0x106 },
+        { "relink",   no_argument,       0, 0x107 },
+        { "link",     required_argument, 0, 0x108 },
         { 0, 0, 0, 0 }
     };
 
@@ -493,7 +463,7 @@ int main(int argc, char *argv[])
             config.compression = ARCHIVE_FILTER_COMPRESS;
             break;
         case 0x100:
-            config.reflink = true;
+            config.link = LINK_REFLINK;
             break;
         case 0x101:
             rebuild = true;
@@ -502,6 +472,24 @@ int main(int argc, char *argv[])
         case 0x102:
             elephant();
             break;
+        case 0x103:
+            config.jobs = parse_jobs(optarg);
+            break;
+        case 0x104:
+            config.checksum_xattr = true;
+            break;
+        case 0x105:
+            config.compression = ARCHIVE_FILTER_ZSTD;
+            break;
+        case 0x106:
+            config.compression_level = parse_compression_level(optarg);
+            break;
+        case 0x107:
+            relink = true;
+            break;
+        case 0x108:
+            config.link = parse_link(optarg);
+            break;
         }
     }
 
@@ -516,6 +504,7 @@ int main(int argc, char *argv[])
         uname(&uts);
         config.arch = strdup(uts.machine);
     }
+    config.arch = intern(config.arch, strlen(config.arch));
 
     if (list && drop)
         errx(EXIT_FAILURE, "List and drop operations are mutually exclusive");
@@ -527,7 +516,15 @@ int main(int argc, char *argv[])
     }
 
     rootname = get_rootname(*argv++), --argc;
-    int ret = init_repo(&repo, rootname, files, !rebuild);
+    /* Listing only needs the names and versions found in the entry
+       pathnames. Dropping needs filenames to match and unlink. */
+    uint64_t fields = update_fields;
+    if (list)
+        fields = 0;
+    else if (drop)
+        fields = PKG_FIELD(PKG_FILENAME);
+
+    int ret = init_repo(&repo, rootname, files, !rebuild, fields);
     if (list) {
         check_posix(ret, "failed to open database %s.db", rootname);
         list_repo(&repo);
@@ -535,6 +532,7 @@ int main(int argc, char *argv[])
     }
 
     alpm_list_t *targets = parse_targets(argv, argc);
+    resolve_link_mode(&repo);
 
     if (drop) {
         drop_from_repo(&repo, targets);
@@ -543,22 +541,35 @@ int main(int argc, char *argv[])
             targets = load_manifest(&repo, rootname);
         }
 
-        struct pkgcache *filecache = get_filecache(repo.poolfd, targets, config.arch);
+        /* A rebuild shouldn't trust anything we remember about the
+           pool, but we still refresh the scan cache for next time */
+        struct scancache *scancache = scancache_load(repo.rootfd, rebuild ? NULL : repo.scanname);
+        struct pool_listing listing;
+        struct pkgcache *filecache = get_filecache(repo.poolfd, scancache, targets,
+                                                   config.arch, &listing);
         check_null(filecache, "failed to get filecache");
 
-        reduce_repo(&repo);
-        update_repo(&repo, filecache);
+        if (scancache_save(scancache, repo.rootfd, repo.scanname) < 0)
+            warn("failed to write scan cache %s", repo.scanname);
+        scancache_free(scancache);
+
+        sync_plan_build(&repo.plan, repo.cache, filecache, &listing);
+        pool_listing_free(&listing);
+        apply_plan(&repo, &repo.plan);
     }
 
     if (!repo.dirty) {
         trace("repo does not need updating\n");
     } else {
-        write_database(&repo, repo.dbname, DB_DESC | DB_DEPENDS);
+        write_databases(&repo);
+    }
 
-        if (repo.filesname) {
-            write_database(&repo, repo.filesname, DB_FILES);
-        }
+    if (repo.dirty || relink)
+        link_db(&repo, relink);
 
-        link_db(&repo);
+    if (repo.cache && (repo.dirty || repo.stale_snapshot)) {
+        if (snapshot_save(repo.rootfd, repo.indexname, repo.dbname,
+                          repo.filesname, repo.cache) < 0)
+            warn("failed to write snapshot %s", repo.indexname);
     }
 }
@@ -2,25 +2,48 @@
 
 #include <stdbool.h>
 #include "pkgcache.h"
+#include "sync.h"
 #include "util.h"
 
+enum link_mode {
+    LINK_SYMLINK,
+    LINK_AUTO,
+    LINK_REFLINK,
+    LINK_COPY,
+    LINK_HARDLINK
+};
+
 struct repo {
     const char *root;
     const char *pool;
+    char *poolpath;
     int rootfd;
     int poolfd;
 
     char *dbname;
     char *filesname;
+    char *scanname;
+    char *indexname;
 
     bool dirty;
+    bool stale_snapshot;
     struct pkgcache *cache;
+
+    /* How packages get from the pool into the root, never LINK_AUTO
+     * once resolve_link_mode() has run */
+    enum link_mode link;
+
+    /* What the last sync changed, filled in before writing */
+    struct sync_plan plan;
 };
 
 struct config {
     int verbose;
     int compression;
-    bool reflink;
+    int compression_level;
+    int jobs;
+    enum link_mode link;
+    bool checksum_xattr;
     bool sign;
     char *arch;
 };
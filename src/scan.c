@@ -0,0 +1,84 @@
+#include "scan.h"
+
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/* Find the first occurrence of either a or b in [p, end), or end. The
+ * desc format only ever needs to find the end of a line, or the end of
+ * a line or the start of a header, so two needles cover everything. */
+typedef const char *(*scan_fn)(const char *p, const char *end, char a, char b);
+
+static const char *scan_scalar(const char *p, const char *end, char a, char b)
+{
+    for (; p < end; ++p) {
+        if (*p == a || *p == b)
+            return p;
+    }
+    return end;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static const char *scan_sse2(const char *p, const char *end, char a, char b)
+{
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+                                                  _mm_cmpeq_epi8(v, vb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+
+    return scan_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char *scan_avx2(const char *p, const char *end, char a, char b)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+                                                             _mm256_cmpeq_epi8(v, vb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+
+    return scan_sse2(p, end, a, b);
+}
+#endif
+
+static scan_fn scan = scan_scalar;
+
+/* Pick the widest implementation the CPU supports once, at startup,
+ * before any threads can be looking at the pointer */
+__attribute__((constructor))
+static void scan_init(void)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        scan = scan_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        scan = scan_sse2;
+#endif
+}
+
+const char *scan_line(const char *p, const char *end)
+{
+    return scan(p, end, '\n', '\n');
+}
+
+const char *scan_value(const char *p, const char *end)
+{
+    return scan(p, end, '\n', '%');
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+const char *scan_line(const char *p, const char *end);
+const char *scan_value(const char *p, const char *end);
@@ -0,0 +1,327 @@
+#include "scancache.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "database.h"
+#include "desc.h"
+#include "pkgcache.h"
+#include "util.h"
+
+/* The scan cache is a flat text file. Each pool file gets one record:
+ *
+ *   P <dev> <ino> <size> <mtime> <sigsize> <sigmtime> <len> <filename>
+ *   <len bytes of desc and depends entries>
+ *
+ * or, for files that failed to load as a package:
+ *
+ *   X <dev> <ino> <size> <mtime> <filename>
+ */
+static const char scancache_magic[] = "repose-scancache 1\n";
+
+static int record_cmp(const void *p1, const void *p2)
+{
+    const struct scan_record *r1 = p1;
+    const struct scan_record *r2 = p2;
+    return strcmp(r1->filename, r2->filename);
+}
+
+static int record_find_cmp(const void *key, const void *p)
+{
+    const struct scan_record *record = p;
+    return strcmp(key, record->filename);
+}
+
+static char *read_file(int fd, size_t *len)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return NULL;
+
+    char *data = malloc(st.st_size + 1);
+    if (!data)
+        return NULL;
+
+    size_t nbytes = 0;
+    while (nbytes < (size_t)st.st_size) {
+        ssize_t nbytes_r = read(fd, data + nbytes, st.st_size - nbytes);
+        if (nbytes_r < 0) {
+            free(data);
+            return NULL;
+        } else if (nbytes_r == 0) {
+            break;
+        }
+        nbytes += nbytes_r;
+    }
+
+    data[nbytes] = 0;
+    *len = nbytes;
+    return data;
+}
+
+static int parse_record(struct scan_record *record, char *p, char *end, char **next)
+{
+    char *eol = memchr(p, '\n', end - p);
+    if (!eol)
+        return -1;
+
+    *eol = 0;
+
+    uintmax_t dev, ino;
+    intmax_t size, mtime, sigsize = -1, sigmtime = -1;
+    size_t desc_len = 0;
+    int offset = -1;
+
+    if (p[0] == 'P') {
+        sscanf(p, "P %ju %ju %jd %jd %jd %jd %zu %n", &dev, &ino, &size,
+               &mtime, &sigsize, &sigmtime, &desc_len, &offset);
+        record->invalid = false;
+    } else if (p[0] == 'X') {
+        sscanf(p, "X %ju %ju %jd %jd %n", &dev, &ino, &size, &mtime, &offset);
+        record->invalid = true;
+    }
+
+    *eol = '\n';
+    if (offset < 0 || p + offset >= eol)
+        return -1;
+    if (desc_len > (size_t)(end - eol - 1))
+        return -1;
+
+    record->filename = strndup(p + offset, eol - p - offset);
+    record->key = (struct scan_key){
+        .dev = dev,
+        .ino = ino,
+        .size = size,
+        .mtime = mtime,
+        .sigsize = sigsize,
+        .sigmtime = sigmtime
+    };
+    record->desc = eol + 1;
+    record->desc_len = desc_len;
+    record->raw = p;
+    record->raw_len = eol + 1 + desc_len - p;
+
+    *next = eol + 1 + desc_len;
+    return 0;
+}
+
+static int parse_scancache(struct scancache *cache, size_t len)
+{
+    const size_t magic_len = strlen(scancache_magic);
+    if (len < magic_len || memcmp(cache->data, scancache_magic, magic_len) != 0)
+        return -1;
+
+    char *p = cache->data + magic_len, *end = cache->data + len;
+    size_t buflen = 0;
+
+    while (p < end) {
+        if (cache->count == buflen) {
+            buflen = buflen ? buflen * 2 : 256;
+            cache->records = realloc(cache->records, buflen * sizeof(struct scan_record));
+            check_null(cache->records, "failed to allocate scan cache");
+        }
+
+        struct scan_record *record = &cache->records[cache->count];
+        if (parse_record(record, p, end, &p) < 0)
+            return -1;
+        cache->count++;
+    }
+
+    qsort(cache->records, cache->count, sizeof(struct scan_record), record_cmp);
+    return 0;
+}
+
+static void scancache_clear(struct scancache *cache)
+{
+    for (size_t i = 0; i < cache->count; ++i)
+        free(cache->records[i].filename);
+    free(cache->records);
+    free(cache->data);
+
+    cache->records = NULL;
+    cache->data = NULL;
+    cache->count = 0;
+}
+
+struct scancache *scancache_load(int dirfd, const char *filename)
+{
+    struct scancache *cache = calloc(1, sizeof(struct scancache));
+    check_null(cache, "failed to allocate scan cache");
+
+    if (!filename)
+        return cache;
+
+    _cleanup_close_ int fd = openat(dirfd, filename, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            warn("failed to open %s", filename);
+        return cache;
+    }
+
+    size_t len;
+    cache->data = read_file(fd, &len);
+    if (!cache->data) {
+        warn("failed to read %s", filename);
+        return cache;
+    }
+
+    if (parse_scancache(cache, len) < 0) {
+        warnx("%s is corrupt, ignoring", filename);
+        scancache_clear(cache);
+    }
+
+    return cache;
+}
+
+int scancache_save(struct scancache *cache, int dirfd, const char *filename)
+{
+    _cleanup_free_ char *tmpname = joinstring(filename, ".tmp", NULL);
+    _cleanup_close_ int fd = openat(dirfd, tmpname, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    const size_t magic_len = strlen(scancache_magic);
+    if (write(fd, scancache_magic, magic_len) != (ssize_t)magic_len)
+        return -1;
+
+    size_t nbytes = 0;
+    while (nbytes < cache->next.len) {
+        ssize_t nbytes_w = write(fd, cache->next.data + nbytes, cache->next.len - nbytes);
+        if (nbytes_w < 0)
+            return -1;
+        nbytes += nbytes_w;
+    }
+
+    return renameat(dirfd, tmpname, dirfd, filename);
+}
+
+void scancache_free(struct scancache *cache)
+{
+    if (!cache)
+        return;
+
+    scancache_clear(cache);
+    buffer_release(&cache->next);
+    free(cache);
+}
+
+int scan_key_stat(int dirfd, const char *filename, struct scan_key *key)
+{
+    struct stat st;
+    if (fstatat(dirfd, filename, &st, 0) < 0)
+        return -1;
+    if (!S_ISREG(st.st_mode)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *key = (struct scan_key){
+        .dev = st.st_dev,
+        .ino = st.st_ino,
+        .size = st.st_size,
+        .mtime = st.st_mtime,
+        .sigsize = -1,
+        .sigmtime = -1
+    };
+
+    _cleanup_free_ char *signame = joinstring(filename, ".sig", NULL);
+    if (fstatat(dirfd, signame, &st, 0) == 0) {
+        key->sigsize = st.st_size;
+        key->sigmtime = st.st_mtime;
+    }
+
+    return 0;
+}
+
+static bool scan_key_eq(const struct scan_key *k1, const struct scan_key *k2,
+                        bool check_signature)
+{
+    if (k1->dev != k2->dev || k1->ino != k2->ino ||
+        k1->size != k2->size || k1->mtime != k2->mtime)
+        return false;
+    if (check_signature)
+        return k1->sigsize == k2->sigsize && k1->sigmtime == k2->sigmtime;
+    return true;
+}
+
+/* Find the record for filename. If a key is given, only return the record
+ * if it still describes the file on disk. */
+const struct scan_record *scancache_find(const struct scancache *cache,
+                                         const char *filename,
+                                         const struct scan_key *key)
+{
+    if (!cache || !cache->count)
+        return NULL;
+
+    const struct scan_record *record = bsearch(filename, cache->records, cache->count,
+                                               sizeof(struct scan_record), record_find_cmp);
+
+    if (!record || !key)
+        return record;
+    if (scan_key_eq(&record->key, key, !record->invalid))
+        return record;
+    return NULL;
+}
+
+struct pkg *scancache_get_pkg(const struct scan_record *record)
+{
+    struct pkg *pkg = malloc(sizeof(pkg_t));
+    check_null(pkg, "failed to allocate package");
+    *pkg = (struct pkg){ .filename = strdup(record->filename) };
+
+    struct desc_parser parser;
+    desc_parser_init(&parser);
+    if (desc_parse(&parser, pkg, record->desc, record->desc_len) < 0 || !pkg->name) {
+        package_free(pkg);
+        return NULL;
+    }
+
+    pkg->hash = strhash(pkg->name);
+    pkg->size = record->key.size;
+    pkg->mtime = record->key.mtime;
+    if (pkg->base64sig && record->key.sigmtime > pkg->mtime)
+        pkg->mtime = record->key.sigmtime;
+
+    return pkg;
+}
+
+void scancache_render(struct buffer *buf, const char *filename,
+                      const struct scan_key *key, struct pkg *pkg)
+{
+    /* Filenames are stored one per line */
+    if (strchr(filename, '\n'))
+        return;
+
+    if (!pkg) {
+        buffer_printf(buf, "X %ju %ju %jd %jd %s\n",
+                      (uintmax_t)key->dev, (uintmax_t)key->ino,
+                      (intmax_t)key->size, (intmax_t)key->mtime, filename);
+        return;
+    }
+
+    struct buffer desc = {0};
+    write_desc(&desc, pkg);
+    write_depends(&desc, pkg);
+
+    buffer_printf(buf, "P %ju %ju %jd %jd %jd %jd %zu %s\n",
+                  (uintmax_t)key->dev, (uintmax_t)key->ino,
+                  (intmax_t)key->size, (intmax_t)key->mtime,
+                  (intmax_t)key->sigsize, (intmax_t)key->sigmtime,
+                  desc.len, filename);
+    buffer_append(buf, desc.data, desc.len);
+    buffer_release(&desc);
+}
+
+void scancache_append(struct scancache *cache, const char *data, size_t len)
+{
+    buffer_append(&cache->next, data, len);
+}
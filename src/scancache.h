@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+#include "package.h"
+#include "buffer.h"
+
+/* Identifies one version of a file in the pool. If any of these change
+ * the cached metadata for that file is considered stale. */
+struct scan_key {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    off_t sigsize;
+    time_t sigmtime;
+};
+
+struct scan_record {
+    char *filename;
+    struct scan_key key;
+    bool invalid;
+    char *desc;
+    size_t desc_len;
+    const char *raw;
+    size_t raw_len;
+};
+
+struct scancache {
+    char *data;
+    struct scan_record *records;
+    size_t count;
+    struct buffer next;
+};
+
+struct scancache *scancache_load(int dirfd, const char *filename);
+int scancache_save(struct scancache *cache, int dirfd, const char *filename);
+void scancache_free(struct scancache *cache);
+
+int scan_key_stat(int dirfd, const char *filename, struct scan_key *key);
+const struct scan_record *scancache_find(const struct scancache *cache,
+                                         const char *filename,
+                                         const struct scan_key *key);
+struct pkg *scancache_get_pkg(const struct scan_record *record);
+
+void scancache_render(struct buffer *buf, const char *filename,
+                      const struct scan_key *key, struct pkg *pkg);
+void scancache_append(struct scancache *cache, const char *data, size_t len);
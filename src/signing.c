@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <locale.h>
 #include <errno.h>
+#include <pthread.h>
 #include <err.h>
 #include <gpgme.h>
 #include <gpg-error.h>
@@ -36,7 +37,7 @@ static inline char *sig_for(const char *file)
     return joinstring(file, ".sig", NULL);
 }
 
-static int init_gpgme(void)
+static int init_gpgme_locked(void)
 {
     static int inited = false;
     gpgme_error_t err;
@@ -67,6 +68,17 @@ static int init_gpgme(void)
     return 0;
 }
 
+/* The databases may be signed from different threads as they finish */
+static int init_gpgme(void)
+{
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+    pthread_mutex_lock(&lock);
+    int ret = init_gpgme_locked();
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
 int gpgme_verify(int rootfd, const char *file)
 {
     gpgme_error_t err;
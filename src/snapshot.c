@@ -0,0 +1,396 @@
+#include "snapshot.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "buffer.h"
+#include "checksum.h"
+#include "database.h"
+#include "package.h"
+#include "repose.h"
+#include "util.h"
+
+/* A snapshot is a flat, native endian image of the parsed repository,
+ * meant to be mapped and used in place:
+ *
+ *   header | records[count] | string table | blobs
+ *
+ * Strings and blobs are addressed by offset from the start of their
+ * section. The desc, depends and files entries of each package are
+ * stored exactly as they appear in the databases, so a package loaded
+ * from a snapshot is written back out without ever being parsed. */
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_NONE    UINT64_MAX
+
+static const char snapshot_magic[8] = "REPOSEIX";
+
+/* Everything the update path compares is stored pre-parsed, the rest is
+ * parsed out of the raw desc entry on demand */
+static const uint64_t snapshot_fields =
+    PKG_FIELD(PKG_PKGNAME) | PKG_FIELD(PKG_VERSION) | PKG_FIELD(PKG_FILENAME) |
+    PKG_FIELD(PKG_BUILDDATE) | PKG_FIELD(PKG_PGPSIG) | PKG_FIELD(PKG_SHA256SUM);
+
+/* The database a snapshot was taken of. A missing database is all zeros. */
+struct snapshot_source {
+    uint64_t size;
+    uint64_t ino;
+    int64_t mtime;
+    int64_t mtime_nsec;
+    char sha256sum[64];
+};
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t strings_len;
+    uint64_t blobs_len;
+    struct snapshot_source db;
+    struct snapshot_source files;
+};
+
+struct snapshot_blob {
+    uint64_t offset;
+    uint64_t len;
+};
+
+struct snapshot_record {
+    uint64_t name;
+    uint64_t version;
+    uint64_t filename;
+    uint64_t sha256sum;
+    uint64_t base64sig;
+    int64_t builddate;
+    struct snapshot_blob desc;
+    struct snapshot_blob depends;
+    struct snapshot_blob files;
+};
+
+struct snapshot_view {
+    void *map;
+    size_t len;
+    const struct snapshot_header *header;
+    const struct snapshot_record *records;
+    const char *strings;
+    char *blobs;
+};
+
+static int snapshot_source(int rootfd, const char *filename, struct snapshot_source *source)
+{
+    *source = (struct snapshot_source){0};
+    if (!filename)
+        return 0;
+
+    struct stat st;
+    if (fstatat(rootfd, filename, &st, 0) < 0)
+        return errno == ENOENT ? 0 : -1;
+
+    _cleanup_free_ char *sha256sum = sha256_file(rootfd, filename, false, NULL);
+    if (!sha256sum)
+        return -1;
+
+    source->size = st.st_size;
+    source->ino = st.st_ino;
+    source->mtime = st.st_mtim.tv_sec;
+    source->mtime_nsec = st.st_mtim.tv_nsec;
+    memcpy(source->sha256sum, sha256sum, sizeof(source->sha256sum));
+    return 0;
+}
+
+/* A database which still has the same size, inode and mtime is taken
+ * to be unchanged, one with a different size to have changed. Only
+ * when the two disagree is the database hashed. */
+static bool snapshot_source_matches(int rootfd, const char *filename,
+                                    const struct snapshot_source *expected)
+{
+    struct stat st;
+    if (!filename || fstatat(rootfd, filename, &st, 0) < 0)
+        return expected->size == 0 && expected->ino == 0;
+
+    if ((uint64_t)st.st_size != expected->size)
+        return false;
+    if (st.st_ino == expected->ino &&
+        st.st_mtim.tv_sec == expected->mtime &&
+        st.st_mtim.tv_nsec == expected->mtime_nsec)
+        return true;
+
+    _cleanup_free_ char *sha256sum = sha256_file(rootfd, filename, false, NULL);
+    return sha256sum && memcmp(sha256sum, expected->sha256sum,
+                               sizeof(expected->sha256sum)) == 0;
+}
+
+static const char *view_string(const struct snapshot_view *view, uint64_t offset)
+{
+    if (offset == SNAPSHOT_NONE)
+        return NULL;
+    if (offset >= view->header->strings_len)
+        return NULL;
+    if (!memchr(view->strings + offset, 0, view->header->strings_len - offset))
+        return NULL;
+    return view->strings + offset;
+}
+
+static char *view_strdup(const struct snapshot_view *view, uint64_t offset,
+                         struct arena *arena)
+{
+    const char *str = view_string(view, offset);
+    return str ? arena_strdup(arena, str) : NULL;
+}
+
+static bool view_blob(const struct snapshot_view *view, const struct snapshot_blob *blob,
+                      struct raw_entry *raw)
+{
+    if (blob->offset > view->header->blobs_len ||
+        blob->len > view->header->blobs_len - blob->offset)
+        return false;
+
+    if (blob->len)
+        *raw = (struct raw_entry){ view->blobs + blob->offset, blob->len, true };
+    return true;
+}
+
+static int map_snapshot(int fd, struct snapshot_view *view)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct snapshot_header))
+        return -1;
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+
+    const struct snapshot_header *header = (const void *)map;
+    uint64_t size = sizeof(struct snapshot_header);
+
+    if (memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION ||
+        header->count > (uint64_t)st.st_size / sizeof(struct snapshot_record))
+        goto corrupt;
+
+    size += header->count * sizeof(struct snapshot_record);
+    if (__builtin_add_overflow(size, header->strings_len, &size) ||
+        __builtin_add_overflow(size, header->blobs_len, &size) ||
+        size != (uint64_t)st.st_size)
+        goto corrupt;
+
+    *view = (struct snapshot_view){
+        .map = map,
+        .len = st.st_size,
+        .header = header,
+        .records = (const void *)(map + sizeof(struct snapshot_header)),
+        .strings = map + st.st_size - header->blobs_len - header->strings_len,
+        .blobs = map + st.st_size - header->blobs_len,
+    };
+    return 0;
+
+corrupt:
+    munmap(map, st.st_size);
+    return -1;
+}
+
+static void unmap_snapshot(struct snapshot_view *view)
+{
+    munmap(view->map, view->len);
+}
+
+static struct pkg *load_record(const struct snapshot_view *view,
+                               const struct snapshot_record *record, time_t mtime,
+                               struct arena *arena)
+{
+    const char *name = view_string(view, record->name);
+    const char *version = view_string(view, record->version);
+    if (!name || !version)
+        return NULL;
+
+    struct pkg *pkg = arena_alloc(arena, sizeof(struct pkg));
+    check_null(pkg, "failed to allocate package");
+
+    *pkg = (struct pkg){
+        .hash = strhash(name),
+        .name = arena_strdup(arena, name),
+        .version = arena_strdup(arena, version),
+        .filename = view_strdup(view, record->filename, arena),
+        .sha256sum = view_strdup(view, record->sha256sum, arena),
+        .base64sig = view_strdup(view, record->base64sig, arena),
+        .builddate = record->builddate,
+        .mtime = mtime,
+        .lazy = ~snapshot_fields,
+        .arena = arena
+    };
+
+    if (!view_blob(view, &record->desc, &pkg->raw_desc) ||
+        !view_blob(view, &record->depends, &pkg->raw_depends) ||
+        !view_blob(view, &record->files, &pkg->raw_files)) {
+        package_free(pkg);
+        return NULL;
+    }
+
+    return pkg;
+}
+
+/* Load the repository from its snapshot, provided the snapshot was
+ * taken of the databases as they are now. The files database is only
+ * checked if check_files is set. The mapping is deliberately left in
+ * place for the rest of the run: packages point into it. */
+int snapshot_load(int rootfd, const char *filename, const char *dbname,
+                  const char *filesname, bool check_files,
+                  struct pkgcache **pkgcache)
+{
+    _cleanup_close_ int fd = openat(rootfd, filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct snapshot_view view;
+    if (map_snapshot(fd, &view) < 0) {
+        warnx("%s is corrupt, ignoring", filename);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstatat(rootfd, dbname, &st, 0) < 0) {
+        unmap_snapshot(&view);
+        return -1;
+    }
+
+    if (!snapshot_source_matches(rootfd, dbname, &view.header->db) ||
+        (check_files && !snapshot_source_matches(rootfd, filesname, &view.header->files))) {
+        trace("%s is stale\n", filename);
+        unmap_snapshot(&view);
+        return -1;
+    }
+
+    struct pkgcache *cache = pkgcache_create(view.header->count);
+    for (uint64_t i = 0; i < view.header->count; ++i) {
+        struct pkg *pkg = load_record(&view, &view.records[i], st.st_mtime,
+                                      &cache->arena);
+        if (!pkg) {
+            warnx("%s is corrupt, ignoring", filename);
+            struct pkg *loaded;
+            pkgcache_foreach(cache, loaded)
+                package_free(loaded);
+            pkgcache_free(cache);
+            unmap_snapshot(&view);
+            return -1;
+        }
+        cache = pkgcache_add(cache, pkg);
+    }
+    pkgcache_sort(cache);
+
+    pkgcache_free(*pkgcache);
+    *pkgcache = cache;
+    return 0;
+}
+
+static uint64_t add_string(struct buffer *strings, const char *str)
+{
+    if (!str)
+        return SNAPSHOT_NONE;
+
+    uint64_t offset = strings->len;
+    buffer_append(strings, str, strlen(str) + 1);
+    return offset;
+}
+
+static struct snapshot_blob add_blob(struct buffer *blobs, const struct raw_entry *raw)
+{
+    struct snapshot_blob blob = { blobs->len, raw->len };
+    if (raw->len)
+        buffer_append(blobs, raw->data, raw->len);
+    return blob;
+}
+
+static int write_buffer(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len) {
+        ssize_t nbytes_w = write(fd, p, len);
+        if (nbytes_w < 0)
+            return -1;
+        p += nbytes_w;
+        len -= nbytes_w;
+    }
+    return 0;
+}
+
+/* Packages which don't have their entries as they appear in the
+ * databases can't be snapshotted. Quietly skip writing the snapshot,
+ * the next run will take one. */
+static bool can_snapshot(struct pkgcache *pkgcache)
+{
+    const struct pkg *pkg;
+    pkgcache_foreach(pkgcache, pkg) {
+        if (!pkg->raw_desc.data)
+            return false;
+    }
+    return true;
+}
+
+int snapshot_save(int rootfd, const char *filename, const char *dbname,
+                  const char *filesname, struct pkgcache *pkgcache)
+{
+    if (!can_snapshot(pkgcache))
+        return 0;
+
+    struct snapshot_header header = {
+        .version = SNAPSHOT_VERSION,
+    };
+    memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+
+    if (snapshot_source(rootfd, dbname, &header.db) < 0 ||
+        snapshot_source(rootfd, filesname, &header.files) < 0)
+        return -1;
+
+    struct buffer records = {0}, strings = {0}, blobs = {0};
+    struct pkg *pkg;
+    pkgcache_foreach(pkgcache, pkg) {
+        database_materialize(pkg, snapshot_fields);
+
+        struct snapshot_record record = {
+            .name = add_string(&strings, pkg->name),
+            .version = add_string(&strings, pkg->version),
+            .filename = add_string(&strings, pkg->filename),
+            .sha256sum = add_string(&strings, pkg->sha256sum),
+            .base64sig = add_string(&strings, pkg->base64sig),
+            .builddate = pkg->builddate,
+            .desc = add_blob(&blobs, &pkg->raw_desc),
+            .depends = add_blob(&blobs, &pkg->raw_depends),
+            .files = add_blob(&blobs, &pkg->raw_files),
+        };
+
+        buffer_append(&records, (const char *)&record, sizeof(record));
+        header.count++;
+    }
+
+    header.strings_len = strings.len;
+    header.blobs_len = blobs.len;
+
+    int ret = -1;
+    _cleanup_free_ char *tmpname = joinstring(filename, ".tmp", NULL);
+    _cleanup_close_ int fd = openat(rootfd, tmpname, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0)
+        goto cleanup;
+
+    if (write_buffer(fd, &header, sizeof(header)) < 0 ||
+        write_buffer(fd, records.data, records.len) < 0 ||
+        write_buffer(fd, strings.data, strings.len) < 0 ||
+        write_buffer(fd, blobs.data, blobs.len) < 0)
+        goto cleanup;
+
+    ret = renameat(rootfd, tmpname, rootfd, filename);
+
+cleanup:
+    buffer_release(&records);
+    buffer_release(&strings);
+    buffer_release(&blobs);
+    return ret;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdbool.h>
+#include "pkgcache.h"
+
+int snapshot_load(int rootfd, const char *filename, const char *dbname,
+                  const char *filesname, bool check_files,
+                  struct pkgcache **pkgcache);
+int snapshot_save(int rootfd, const char *filename, const char *dbname,
+                  const char *filesname, struct pkgcache *pkgcache);
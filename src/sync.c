@@ -0,0 +1,160 @@
+#include "sync.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "repose.h"
+#include "version.h"
+#include "util.h"
+
+/* The plan is built out of two merge-joins. The database is first
+ * joined against the pool listing by filename, to find the packages
+ * whose file is gone, and then against the packages scanned out of
+ * the pool by name, to find what needs to be added or updated. Both
+ * sides are sorted up front so each join is a single linear pass. */
+struct sync_entry {
+    struct pkg *pkg;
+    bool present;
+};
+
+static int entry_filename_cmp(const void *p1, const void *p2)
+{
+    const char *f1 = (*(struct sync_entry * const *)p1)->pkg->filename;
+    const char *f2 = (*(struct sync_entry * const *)p2)->pkg->filename;
+
+    if (!f1 || !f2)
+        return !!f1 - !!f2;
+    return strcmp(f1, f2);
+}
+
+static void mark_present(struct sync_entry *entries, size_t count,
+                         const struct pool_listing *listing)
+{
+    struct sync_entry **byfile = malloc(count * sizeof(struct sync_entry *));
+    check_null(byfile, "failed to allocate sync plan");
+
+    for (size_t i = 0; i < count; ++i)
+        byfile[i] = &entries[i];
+    qsort(byfile, count, sizeof(struct sync_entry *), entry_filename_cmp);
+
+    size_t i = 0, j = 0;
+    while (i < count && j < listing->count) {
+        const char *filename = byfile[i]->pkg->filename;
+        if (!filename) {
+            ++i;
+            continue;
+        }
+
+        int cmp = strcmp(filename, listing->filenames[j]);
+        if (cmp < 0)
+            ++i;
+        else if (cmp > 0)
+            ++j;
+        else
+            byfile[i++]->present = true;
+    }
+
+    free(byfile);
+}
+
+static void plan_push(struct sync_plan *plan, size_t *size, enum sync_type type,
+                      struct pkg *pkg, struct pkg *old)
+{
+    if (plan->count == *size) {
+        *size = *size ? *size * 2 : 64;
+        plan->actions = realloc(plan->actions, *size * sizeof(struct sync_action));
+        check_null(plan->actions, "failed to allocate sync plan");
+    }
+
+    plan->actions[plan->count++] = (struct sync_action){ type, pkg, old };
+}
+
+static bool needs_update(struct pkg *pkg, struct pkg *old)
+{
+    switch (pkg_vercmp(pkg, old)) {
+    case 1:
+        /* The filecache package has a newer version than the
+           package in the database. */
+        trace("updating %s %s => %s\n", pkg->name, old->version, pkg->version);
+        return true;
+    case 0:
+        /* The filecache package has the same version as the
+           package in the database. Only update the package if the
+           file is newer than the database */
+        if (pkg->mtime > old->mtime) {
+            trace("updating %s %s [newer timestamp]\n", pkg->name, pkg->version);
+        } else if (pkg->builddate > old->builddate) {
+            trace("updating %s %s [newer build]\n", pkg->name, pkg->version);
+        } else if (old->base64sig == NULL && pkg->base64sig) {
+            trace("adding signature for %s\n", pkg->name);
+        } else {
+            return false;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Work out what it takes to bring the database up to date with the
+ * pool. Removals are only planned for packages missing from listing;
+ * the packages in pool may be a filtered subset of it. The plan comes
+ * out in name order, a removal always ahead of the add which takes
+ * its place. */
+void sync_plan_build(struct sync_plan *plan, struct pkgcache *db,
+                     struct pkgcache *pool, const struct pool_listing *listing)
+{
+    size_t size = 0, ndb = db ? db->entries : 0;
+    struct sync_entry *entries = NULL;
+
+    *plan = (struct sync_plan){0};
+    pkgcache_sort(db);
+    pkgcache_sort(pool);
+
+    if (ndb) {
+        entries = calloc(ndb, sizeof(struct sync_entry));
+        check_null(entries, "failed to allocate sync plan");
+
+        struct pkg *pkg;
+        size_t i = 0;
+        pkgcache_foreach(db, pkg)
+            entries[i++].pkg = pkg;
+
+        mark_present(entries, ndb, listing);
+    }
+
+    size_t i = 0, iter = 0;
+    struct pkg *pkg = pool ? pkgcache_next(pool, &iter) : NULL;
+
+    while (i < ndb || pkg) {
+        const struct sync_entry *entry = i < ndb ? &entries[i] : NULL;
+        int cmp = !entry ? 1 : !pkg ? -1 : strcmp(entry->pkg->name, pkg->name);
+
+        if (cmp <= 0 && !entry->present) {
+            trace("dropping %s\n", entry->pkg->name);
+            plan_push(plan, &size, SYNC_REMOVE, entry->pkg, NULL);
+        }
+
+        if (cmp > 0 || (cmp == 0 && !entry->present)) {
+            /* The package isn't already in the database. Just add it */
+            trace("adding %s %s\n", pkg->name, pkg->version);
+            plan_push(plan, &size, SYNC_ADD, pkg, NULL);
+        } else if (cmp == 0 && needs_update(pkg, entry->pkg)) {
+            plan_push(plan, &size, SYNC_UPDATE, pkg, entry->pkg);
+        }
+
+        if (cmp <= 0)
+            ++i;
+        if (cmp >= 0)
+            pkg = pkgcache_next(pool, &iter);
+    }
+
+    free(entries);
+}
+
+void sync_plan_free(struct sync_plan *plan)
+{
+    free(plan->actions);
+    *plan = (struct sync_plan){0};
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include "package.h"
+#include "pkgcache.h"
+#include "filecache.h"
+
+enum sync_type {
+    SYNC_ADD,
+    SYNC_UPDATE,
+    SYNC_REMOVE
+};
+
+/* For SYNC_ADD and SYNC_UPDATE pkg is the package out of the pool, and
+ * old the database package it replaces. For SYNC_REMOVE pkg is the
+ * database package whose file has left the pool. */
+struct sync_action {
+    enum sync_type type;
+    struct pkg *pkg;
+    struct pkg *old;
+};
+
+struct sync_plan {
+    struct sync_action *actions;
+    size_t count;
+};
+
+void sync_plan_build(struct sync_plan *plan, struct pkgcache *db,
+                     struct pkgcache *pool, const struct pool_listing *listing);
+void sync_plan_free(struct sync_plan *plan);
@@ -0,0 +1,272 @@
+#include "version.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "package.h"
+#include "util.h"
+
+/* This follows libalpm's rpmvercmp() step for step, only the string
+ * scanning happens once when the key is built. Character classes are
+ * tested with the same ctype calls so the results match in any locale. */
+
+enum segment_type {
+    SEGMENT_DIGIT,
+    SEGMENT_ALPHA,
+    /* isalnum() but neither isdigit() nor isalpha(), rpmvercmp()
+     * always bails out on these */
+    SEGMENT_OTHER
+};
+
+/* What rpmvercmp() sees under its cursor once either side runs out */
+enum cursor {
+    CURSOR_END,
+    CURSOR_ALPHA,
+    CURSOR_OTHER
+};
+
+struct version_segment {
+    const char *start;
+    size_t len;
+    size_t sep;
+    enum segment_type type;
+};
+
+struct version_part {
+    const char *str;
+    size_t len;
+    struct version_segment *segments;
+    size_t count;
+    bool trailing;
+};
+
+struct version_key {
+    struct version_part epoch;
+    struct version_part version;
+    struct version_part release;
+    bool has_release;
+    struct version_segment segments[];
+};
+
+static const char default_epoch[] = "0";
+
+static const char *skip_separators(const char *p, const char *end)
+{
+    while (p < end && !isalnum((int)*p))
+        ++p;
+    return p;
+}
+
+static size_t count_segments(const char *p, const char *end)
+{
+    size_t count = 0;
+
+    for (p = skip_separators(p, end); p < end; p = skip_separators(p, end)) {
+        if (isdigit((int)*p)) {
+            while (p < end && isdigit((int)*p))
+                ++p;
+        } else if (isalpha((int)*p)) {
+            while (p < end && isalpha((int)*p))
+                ++p;
+        } else {
+            ++p;
+        }
+        ++count;
+    }
+
+    return count;
+}
+
+static void split_segments(struct version_part *part, struct version_segment *segments,
+                           const char *p, const char *end)
+{
+    *part = (struct version_part){
+        .str = p,
+        .len = end - p,
+        .segments = segments
+    };
+
+    for (;;) {
+        const char *sep = p;
+        p = skip_separators(p, end);
+        if (p == end) {
+            part->trailing = p > sep;
+            return;
+        }
+
+        struct version_segment *segment = &segments[part->count++];
+        *segment = (struct version_segment){ .start = p, .sep = p - sep };
+
+        if (isdigit((int)*p)) {
+            while (p < end && isdigit((int)*p))
+                ++p;
+
+            /* Leading zeros don't count */
+            while (segment->start < p && *segment->start == '0')
+                ++segment->start;
+            segment->type = SEGMENT_DIGIT;
+        } else if (isalpha((int)*p)) {
+            while (p < end && isalpha((int)*p))
+                ++p;
+            segment->type = SEGMENT_ALPHA;
+        } else {
+            segment->start = ++p;
+            segment->type = SEGMENT_OTHER;
+        }
+
+        segment->len = p - segment->start;
+    }
+}
+
+struct version_key *version_key_new(const char *version)
+{
+    const char *end = version + strlen(version);
+
+    /* [epoch:]pkgver[-pkgrel], split the same way as parseEVR() */
+    const char *s = version;
+    while (*s && isdigit((int)*s))
+        ++s;
+    const char *rel = strrchr(s, '-');
+
+    const char *epoch = default_epoch, *epoch_end = default_epoch + 1;
+    const char *ver = version;
+    if (*s == ':') {
+        if (s > version) {
+            epoch = version;
+            epoch_end = s;
+        }
+        ver = s + 1;
+    }
+    const char *ver_end = rel ? rel : end;
+
+    size_t count = count_segments(epoch, epoch_end) + count_segments(ver, ver_end);
+    if (rel)
+        count += count_segments(rel + 1, end);
+
+    struct version_key *key = malloc(sizeof(struct version_key) +
+                                     count * sizeof(struct version_segment));
+    check_null(key, "failed to allocate version key");
+
+    struct version_segment *segments = key->segments;
+    split_segments(&key->epoch, segments, epoch, epoch_end);
+    segments += key->epoch.count;
+    split_segments(&key->version, segments, ver, ver_end);
+    segments += key->version.count;
+
+    key->has_release = rel != NULL;
+    if (rel) {
+        split_segments(&key->release, segments, rel + 1, end);
+    } else {
+        key->release = (struct version_part){0};
+    }
+
+    return key;
+}
+
+/* The cursor where the segment loop stops because one side ran out,
+ * before any separators are skipped */
+static enum cursor cursor_at(const struct version_part *part, size_t i)
+{
+    if (i < part->count) {
+        const struct version_segment *segment = &part->segments[i];
+        if (segment->sep == 0 && segment->type == SEGMENT_ALPHA)
+            return CURSOR_ALPHA;
+        return CURSOR_OTHER;
+    }
+    return part->trailing ? CURSOR_OTHER : CURSOR_END;
+}
+
+/* The cursor once separators have been skipped */
+static enum cursor cursor_after(const struct version_part *part, size_t i)
+{
+    if (i < part->count)
+        return part->segments[i].type == SEGMENT_ALPHA ? CURSOR_ALPHA : CURSOR_OTHER;
+    return CURSOR_END;
+}
+
+/* A remaining alpha segment never beats running out */
+static int showdown(enum cursor c1, enum cursor c2)
+{
+    if (c1 == CURSOR_END && c2 == CURSOR_END)
+        return 0;
+    if ((c1 == CURSOR_END && c2 != CURSOR_ALPHA) || c1 == CURSOR_ALPHA)
+        return -1;
+    return 1;
+}
+
+static int compare_segments(const struct version_segment *s1,
+                            const struct version_segment *s2)
+{
+    if (s1->sep != s2->sep)
+        return s1->sep < s2->sep ? -1 : 1;
+
+    if (s1->type == SEGMENT_OTHER)
+        return -1;
+    /* Numeric segments are always newer than alpha ones */
+    if (s1->type != s2->type)
+        return s1->type == SEGMENT_DIGIT ? 1 : -1;
+
+    /* Otherwise whichever number has more digits wins */
+    if (s1->type == SEGMENT_DIGIT && s1->len != s2->len)
+        return s1->len < s2->len ? -1 : 1;
+
+    int rc = memcmp(s1->start, s2->start, s1->len < s2->len ? s1->len : s2->len);
+    if (rc == 0 && s1->len != s2->len)
+        rc = s1->len < s2->len ? -1 : 1;
+    return rc < 0 ? -1 : rc > 0;
+}
+
+static int compare_parts(const struct version_part *p1, const struct version_part *p2)
+{
+    /* rpmvercmp() starts by checking the strings for equality, which
+     * matters for SEGMENT_OTHER: it compares unequal even to itself */
+    if (p1->len == p2->len && memcmp(p1->str, p2->str, p1->len) == 0)
+        return 0;
+
+    for (size_t i = 0;; ++i) {
+        bool more1 = i < p1->count || (i == p1->count && p1->trailing);
+        bool more2 = i < p2->count || (i == p2->count && p2->trailing);
+        if (!more1 || !more2)
+            return showdown(cursor_at(p1, i), cursor_at(p2, i));
+
+        if (i >= p1->count || i >= p2->count)
+            return showdown(cursor_after(p1, i), cursor_after(p2, i));
+
+        int ret = compare_segments(&p1->segments[i], &p2->segments[i]);
+        if (ret)
+            return ret;
+    }
+}
+
+int version_key_cmp(const struct version_key *k1, const struct version_key *k2)
+{
+    int ret = compare_parts(&k1->epoch, &k2->epoch);
+    if (ret == 0) {
+        ret = compare_parts(&k1->version, &k2->version);
+        if (ret == 0 && k1->has_release && k2->has_release)
+            ret = compare_parts(&k1->release, &k2->release);
+    }
+    return ret;
+}
+
+static const struct version_key *pkg_version_key(struct pkg *pkg)
+{
+    if (!pkg->vkey && pkg->version)
+        pkg->vkey = version_key_new(pkg->version);
+    return pkg->vkey;
+}
+
+/* Same as alpm_pkg_vercmp(pkg1->version, pkg2->version). Keys are
+ * built on first use, so this isn't safe to call on the same package
+ * from multiple threads. */
+int pkg_vercmp(struct pkg *pkg1, struct pkg *pkg2)
+{
+    const struct version_key *k1 = pkg_version_key(pkg1);
+    const struct version_key *k2 = pkg_version_key(pkg2);
+
+    if (!k1 || !k2)
+        return !k1 && !k2 ? 0 : k1 ? 1 : -1;
+    return version_key_cmp(k1, k2);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+struct pkg;
+struct version_key;
+
+/* A version string split into epoch, pkgver and pkgrel, and those into
+ * the segments alpm_pkg_vercmp compares, once up front. The key points
+ * into the version string, which has to outlive it. */
+struct version_key *version_key_new(const char *version);
+int version_key_cmp(const struct version_key *k1, const struct version_key *k2);
+
+int pkg_vercmp(struct pkg *pkg1, struct pkg *pkg2);
@@ -1,6 +1,7 @@
 #define SIZE_MAX ...
 
 typedef int... time_t;
+typedef uint64_t hash_t;
 
 typedef struct __alpm_list_t {
     void *data;
@@ -23,6 +24,7 @@ struct pkg {
     size_t isize;
     time_t builddate;
     time_t mtime;
+    hash_t hash;
 
     alpm_list_t *groups;
     alpm_list_t *licenses;
@@ -66,15 +68,28 @@ enum pkg_entry {
     PKG_MAKEPKGOPT
 };
 
+struct pkg_filename {
+    char *name;
+    char *version;
+    char *arch;
+    ...;
+};
+
+int parse_package_filename(const char *filename, struct pkg_filename *info);
+void pkg_filename_free(struct pkg_filename *info);
+
 // desc
 struct desc_parser {
     enum pkg_entry entry;
+    uint64_t fields;
     ...;
 };
 
 void desc_parser_init(struct desc_parser *parser);
 ssize_t desc_parser_feed(struct desc_parser *parser, struct pkg *pkg,
                          char *buf, size_t buf_len);
+ssize_t desc_parse(struct desc_parser *parser, struct pkg *pkg,
+                   char *buf, size_t buf_len);
 
 // pkginfo
 struct pkginfo_parser {
@@ -86,6 +101,62 @@ void pkginfo_parser_init(struct pkginfo_parser *parser);
 ssize_t pkginfo_parser_feed(struct pkginfo_parser *parser, struct pkg *pkg,
                             char *buf, size_t buf_len);
 
+// pkgcache
+struct pkgcache {
+    size_t entries;
+    ...;
+};
+
+hash_t strhash(const char *str);
+hash_t strnhash(const char *str, size_t len);
+
+struct pkgcache *pkgcache_create(size_t size);
+void pkgcache_free(struct pkgcache *cache);
+
+struct pkgcache *pkgcache_add(struct pkgcache *cache, struct pkg *pkg);
+struct pkgcache *pkgcache_remove(struct pkgcache *cache, struct pkg *pkg, struct pkg **data);
+void pkgcache_sort(struct pkgcache *cache);
+struct pkg *pkgcache_find(struct pkgcache *cache, const char *name);
+struct pkg *pkgcache_next(const struct pkgcache *cache, size_t *iter);
+
+// intern
+char *intern(const char *str, size_t len);
+
+// version
+struct version_key;
+
+struct version_key *version_key_new(const char *version);
+int version_key_cmp(const struct version_key *k1, const struct version_key *k2);
+int alpm_pkg_vercmp(const char *a, const char *b);
+void free(void *ptr);
+
+// sync
+enum sync_type {
+    SYNC_ADD,
+    SYNC_UPDATE,
+    SYNC_REMOVE
+};
+
+struct sync_action {
+    enum sync_type type;
+    struct pkg *pkg;
+    struct pkg *old;
+};
+
+struct sync_plan {
+    struct sync_action *actions;
+    size_t count;
+};
+
+struct pool_listing {
+    char **filenames;
+    size_t count;
+};
+
+void sync_plan_build(struct sync_plan *plan, struct pkgcache *db,
+                     struct pkgcache *pool, const struct pool_listing *listing);
+void sync_plan_free(struct sync_plan *plan);
+
 // utils
 char *joinstring(const char *root, ...);
 int parse_size(const char *str, size_t *out);
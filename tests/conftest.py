@@ -5,7 +5,10 @@ import cffi
 CFLAGS = ['-std=c11', '-O0', '-g', '-D_GNU_SOURCE']
 SOURCES = ['../src/desc.c', '../src/pkginfo.c',
            '../src/package.c', '../src/pkgcache.c',
-           '../src/util.c', '../src/base64.c']
+           '../src/util.c', '../src/base64.c',
+           '../src/scan.c', '../src/arena.c',
+           '../src/intern.c', '../src/version.c',
+           '../src/sync.c']
 
 
 def pytest_configure(config):
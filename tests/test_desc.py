@@ -106,6 +106,18 @@ def test_parse_depends(pkg, parser):
     assert pkg.makedepends == ['git']
 
 
+def test_parse_selected_fields(pkg, parser):
+    parser.parser.fields = (1 << lib.PKG_FILENAME) | (1 << lib.PKG_BUILDDATE)
+    parser.feed(pkg, REPOSE_DESC)
+
+    assert pkg.filename == 'repose-git-5.19.g82c3d4a-1-x86_64.pkg.tar.xz'
+    assert pkg.builddate == "Nov 28, 2015, 06:04:29"
+    assert pkg.desc is None
+    assert pkg.sha256sum is None
+    assert pkg.url is None
+    assert pkg.licenses == []
+
+
 @pytest.mark.parametrize('chunksize', [1, 10, 100])
 def test_parse_chunked(pkg, parser, chunksize):
     def chunk(data, size):
@@ -126,3 +138,37 @@ def test_parse_chunked(pkg, parser, chunksize):
     assert pkg.builddate == "Nov 28, 2015, 06:04:29"
     assert pkg.packager == 'Simon Gomizelj <simongmzlj@gmail.com>'
     assert pkg.licenses == ['GPL']
+
+
+DESC_FIELDS = ['arch', 'base', 'base64sig', 'builddate', 'checkdepends',
+               'conflicts', 'depends', 'desc', 'filename', 'isize', 'licenses',
+               'makedepends', 'optdepends', 'packager', 'provides',
+               'sha256sum', 'size', 'url']
+
+
+@pytest.mark.parametrize('data', [
+    REPOSE_DESC,
+    REPOSE_DEPENDS,
+    REPOSE_DESC + '\n' + REPOSE_DEPENDS,
+    REPOSE_DESC.rstrip('\n'),
+    '\n\n' + REPOSE_DEPENDS + '\n\n',
+    '%DEPENDS%\n' + ''.join('dependency-{}\n'.format(i) for i in range(5000)),
+    '%URL%\nhttp://example.com/%20\n\n',
+    '%BOGUS%\nvalue\n\n',
+    'value outside a section\n',
+    '%DEPENDS%\nfoo\n%CONFLICTS%\nbar\n',
+])
+def test_parse_matches_feed(data):
+    def parse(fn):
+        pkg = Package(name='repose-git', version='5.19.g82c3d4a-1')
+        parser = DescParser()
+        buf = data.encode()
+        result = fn(parser.parser, pkg._struct, buf, len(buf))
+        return result, [getattr(pkg, field) for field in DESC_FIELDS]
+
+    fed_result, fed = parse(lib.desc_parser_feed)
+    parsed_result, parsed = parse(lib.desc_parse)
+
+    assert (fed_result < 0) == (parsed_result < 0)
+    if fed_result >= 0:
+        assert fed == parsed
@@ -0,0 +1,35 @@
+import pytest
+from repose import ffi, lib
+
+
+@pytest.mark.parametrize('filename,expected', [
+    (b'repose-git-6.2.10.gbab93f3-1-x86_64.pkg.tar.xz',
+     (b'repose-git', b'6.2.10.gbab93f3-1', b'x86_64')),
+    (b'systemd-209-1-i686.pkg.tar.zst',
+     (b'systemd', b'209-1', b'i686')),
+    (b'ttf-ms-win10-sea-1:10.0.10240-2-any.pkg.tar',
+     (b'ttf-ms-win10-sea', b'1:10.0.10240-2', b'any')),
+])
+def test_parse_package_filename(filename, expected):
+    info = ffi.new('struct pkg_filename *')
+
+    assert lib.parse_package_filename(filename, info) == 0
+    assert ffi.string(info.name) == expected[0]
+    assert ffi.string(info.version) == expected[1]
+    assert ffi.string(info.arch) == expected[2]
+    lib.pkg_filename_free(info)
+
+
+@pytest.mark.parametrize('filename', [
+    b'repose-git-6.2.10.gbab93f3-1-x86_64.pkg.tar.xz.sig',
+    b'repose-git-6.2.10.gbab93f3-1-x86_64.pkg.tar.zst.part',
+    b'repose.db.tar.gz',
+    b'repose-1-x86_64.pkg.tar.xz',
+    b'-1-1-x86_64.pkg.tar.xz',
+    b'README',
+])
+def test_parse_invalid_package_filename(filename):
+    info = ffi.new('struct pkg_filename *')
+
+    assert lib.parse_package_filename(filename, info) < 0
+    assert info.name == ffi.NULL
@@ -0,0 +1,123 @@
+import pytest
+from repose import ffi, lib
+
+
+class Cache(object):
+    def __init__(self, size=0):
+        self.cache = lib.pkgcache_create(size)
+        self.pkgs = {}
+
+    def __del__(self):
+        lib.pkgcache_free(self.cache)
+
+    def _new_pkg(self, name):
+        cname = ffi.new('char[]', name)
+        pkg = ffi.new('struct pkg*', {'name': cname})
+        pkg.hash = lib.strhash(cname)
+        self.pkgs[name] = (pkg, cname)
+        return pkg
+
+    def add(self, name):
+        self.cache = lib.pkgcache_add(self.cache, self._new_pkg(name))
+
+    def sort(self):
+        lib.pkgcache_sort(self.cache)
+
+    def remove(self, name):
+        data = ffi.new('struct pkg**')
+        self.cache = lib.pkgcache_remove(self.cache, self.pkgs[name][0], data)
+        return data[0]
+
+    def find(self, name):
+        return lib.pkgcache_find(self.cache, name)
+
+    def names(self):
+        it = ffi.new('size_t*', 0)
+        pkg = lib.pkgcache_next(self.cache, it)
+        while pkg != ffi.NULL:
+            yield ffi.string(pkg.name)
+            pkg = lib.pkgcache_next(self.cache, it)
+
+
+NAMES = [b'package-%d' % i for i in range(5000)]
+
+
+def test_strhash():
+    assert lib.strhash(b'glibc') == lib.strnhash(b'glibc-2.38', 5)
+    assert lib.strhash(b'glibc') != lib.strhash(b'glib')
+    assert lib.strhash(ffi.NULL) == 0
+
+
+def test_find():
+    cache = Cache()
+    for name in NAMES:
+        cache.add(name)
+
+    assert cache.cache.entries == len(NAMES)
+    for name in NAMES:
+        assert cache.find(name) == cache.pkgs[name][0]
+    assert cache.find(b'package') == ffi.NULL
+
+
+def test_remove():
+    cache = Cache(len(NAMES))
+    for name in NAMES:
+        cache.add(name)
+    for name in NAMES[::2]:
+        assert cache.remove(name) == cache.pkgs[name][0]
+
+    assert cache.cache.entries == len(NAMES) // 2
+    for name in NAMES[::2]:
+        assert cache.find(name) == ffi.NULL
+    for name in NAMES[1::2]:
+        assert cache.find(name) == cache.pkgs[name][0]
+    assert list(cache.names()) == NAMES[1::2]
+
+
+def test_insertion_order():
+    cache = Cache()
+    for name in NAMES:
+        cache.add(name)
+    for name in NAMES[:4000]:
+        cache.remove(name)
+    for name in NAMES[:100]:
+        cache.add(name)
+
+    assert list(cache.names()) == NAMES[4000:] + NAMES[:100]
+
+
+def test_sort():
+    cache = Cache()
+    for name in reversed(NAMES):
+        cache.add(name)
+    for name in NAMES[::3]:
+        cache.remove(name)
+    cache.sort()
+
+    expected = sorted(set(NAMES) - set(NAMES[::3]))
+    assert list(cache.names()) == expected
+    assert cache.cache.entries == len(expected)
+    for name in expected:
+        assert cache.find(name) == cache.pkgs[name][0]
+    for name in NAMES[::3]:
+        assert cache.find(name) == ffi.NULL
+
+
+def test_sort_already_sorted():
+    cache = Cache()
+    for name in sorted(NAMES):
+        cache.add(name)
+    removed = sorted(NAMES)[::3]
+    for name in removed:
+        cache.remove(name)
+    cache.sort()
+
+    expected = sorted(set(NAMES) - set(removed))
+    assert list(cache.names()) == expected
+    for name in expected:
+        assert cache.find(name) == cache.pkgs[name][0]
+    for name in expected[::2]:
+        assert cache.remove(name) == cache.pkgs[name][0]
+    for name in expected[1::2]:
+        assert cache.find(name) == cache.pkgs[name][0]
+    assert list(cache.names()) == expected[1::2]
@@ -0,0 +1,112 @@
+from repose import ffi, lib
+
+
+class Pool(object):
+    def __init__(self):
+        self.cache = lib.pkgcache_create(0)
+        self.keep = []
+
+    def __del__(self):
+        lib.pkgcache_free(self.cache)
+
+    def _string(self, value):
+        if value is None:
+            return ffi.NULL
+        cvalue = ffi.new('char[]', value)
+        self.keep.append(cvalue)
+        return cvalue
+
+    def add(self, name, version, filename, mtime=0):
+        pkg = ffi.new('struct pkg*', {
+            'name': self._string(name),
+            'version': self._string(version),
+            'filename': self._string(filename),
+            'mtime': mtime,
+        })
+        pkg.hash = lib.strhash(pkg.name)
+        self.keep.append(pkg)
+        self.cache = lib.pkgcache_add(self.cache, pkg)
+        return pkg
+
+
+def build_plan(db, pool, filenames):
+    cfilenames = [ffi.new('char[]', f) for f in sorted(filenames)]
+    array = ffi.new('char*[]', cfilenames)
+    listing = ffi.new('struct pool_listing*', {'filenames': array,
+                                               'count': len(cfilenames)})
+
+    plan = ffi.new('struct sync_plan*')
+    lib.sync_plan_build(plan, db.cache, pool.cache, listing)
+    actions = [(plan.actions[i].type, plan.actions[i].pkg, plan.actions[i].old)
+               for i in range(plan.count)]
+    lib.sync_plan_free(plan)
+    return actions
+
+
+def test_unchanged():
+    db, pool = Pool(), Pool()
+    db.add(b'foo', b'1-1', b'foo-1-1-any.pkg.tar.zst')
+    pool.add(b'foo', b'1-1', b'foo-1-1-any.pkg.tar.zst')
+
+    assert build_plan(db, pool, [b'foo-1-1-any.pkg.tar.zst']) == []
+
+
+def test_add_and_update():
+    db, pool = Pool(), Pool()
+    old = db.add(b'foo', b'1-1', b'foo-1-1-any.pkg.tar.zst')
+    new = pool.add(b'foo', b'2-1', b'foo-2-1-any.pkg.tar.zst')
+    bar = pool.add(b'bar', b'1-1', b'bar-1-1-any.pkg.tar.zst')
+
+    listing = [b'foo-1-1-any.pkg.tar.zst', b'foo-2-1-any.pkg.tar.zst',
+               b'bar-1-1-any.pkg.tar.zst']
+    assert build_plan(db, pool, listing) == [
+        (lib.SYNC_ADD, bar, ffi.NULL),
+        (lib.SYNC_UPDATE, new, old),
+    ]
+
+
+def test_remove_then_readd():
+    db, pool = Pool(), Pool()
+    old = db.add(b'foo', b'2-1', b'foo-2-1-any.pkg.tar.zst')
+    new = pool.add(b'foo', b'1-1', b'foo-1-1-any.pkg.tar.zst')
+
+    # The database's file is gone, so even an older package replaces it
+    assert build_plan(db, pool, [b'foo-1-1-any.pkg.tar.zst']) == [
+        (lib.SYNC_REMOVE, old, ffi.NULL),
+        (lib.SYNC_ADD, new, ffi.NULL),
+    ]
+
+
+def test_null_filename():
+    db, pool = Pool(), Pool()
+    broken = db.add(b'bar', b'1-1', None)
+    db.add(b'foo', b'1-1', b'foo-1-1-any.pkg.tar.zst')
+    pool.add(b'foo', b'1-1', b'foo-1-1-any.pkg.tar.zst')
+
+    assert build_plan(db, pool, [b'foo-1-1-any.pkg.tar.zst']) == [
+        (lib.SYNC_REMOVE, broken, ffi.NULL),
+    ]
+
+
+def test_filtered_targets():
+    db, pool = Pool(), Pool()
+    old = db.add(b'foo', b'1-1', b'foo-1-1-any.pkg.tar.zst')
+    db.add(b'bar', b'1-1', b'bar-1-1-any.pkg.tar.zst')
+    gone = db.add(b'baz', b'1-1', b'baz-1-1-any.pkg.tar.zst')
+    new = pool.add(b'foo', b'1-1', b'foo-1-1-any.pkg.tar.zst', mtime=10)
+
+    # Only foo was scanned, but bar is still in the pool listing
+    listing = [b'foo-1-1-any.pkg.tar.zst', b'bar-1-1-any.pkg.tar.zst']
+    assert build_plan(db, pool, listing) == [
+        (lib.SYNC_REMOVE, gone, ffi.NULL),
+        (lib.SYNC_UPDATE, new, old),
+    ]
+
+
+def test_empty_database():
+    db, pool = Pool(), Pool()
+    foo = pool.add(b'foo', b'1-1', b'foo-1-1-any.pkg.tar.zst')
+
+    assert build_plan(db, pool, [b'foo-1-1-any.pkg.tar.zst']) == [
+        (lib.SYNC_ADD, foo, ffi.NULL),
+    ]
@@ -52,3 +52,10 @@ def test_parse_time():
 
     assert lib.parse_time(arg, out) == 0
     assert out[0] == 1448690669
+
+
+def test_intern():
+    glibc = lib.intern(b'glibc>=2.38', 5)
+    assert ffi.string(glibc) == b'glibc'
+    assert lib.intern(b'glibc', 5) == glibc
+    assert lib.intern(b'glib', 4) != glibc
@@ -0,0 +1,41 @@
+import pytest
+import random
+from repose import ffi, lib
+
+
+def vercmp(v1, v2):
+    k1 = ffi.gc(lib.version_key_new(v1), lib.free)
+    k2 = ffi.gc(lib.version_key_new(v2), lib.free)
+    return lib.version_key_cmp(k1, k2)
+
+
+@pytest.mark.parametrize('v1,v2,expected', [
+    (b'1.0', b'1.0', 0),
+    (b'1.0', b'1.0.1', -1),
+    (b'1.0-1', b'1.0-2', -1),
+    (b'1.0-1', b'1.0', 0),
+    (b'1:1.0', b'2.0', 1),
+    (b'0:1.0', b'1.0', 0),
+    (b'1.0a', b'1.0', -1),
+    (b'1.0rc1', b'1.0', -1),
+    (b'1.0.', b'1.0', 1),
+    (b'1.0..', b'1.0.', 0),
+    (b'1.0_rc1', b'1.0rc1', 1),
+    (b'001', b'1', 0),
+    (b'r1234.g1a2b3c', b'r999.gfff', 1),
+])
+def test_version_key_cmp(v1, v2, expected):
+    assert vercmp(v1, v2) == expected
+    assert vercmp(v2, v1) == -expected
+
+
+def test_version_key_matches_libalpm():
+    rng = random.Random(0)
+    alphabet = b'0000111229.-:_+~abzr'
+
+    def version():
+        return bytes(rng.choice(alphabet) for _ in range(rng.randrange(12)))
+
+    for _ in range(100000):
+        v1, v2 = version(), version()
+        assert vercmp(v1, v2) == lib.alpm_pkg_vercmp(v1, v2), (v1, v2)